@@ -0,0 +1,164 @@
+#include "constants.h"
+#include "camera.h"
+#include "scenes.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// renders a fixed set of seeded scenes at a sweep of thread counts and prints the
+// throughput numbers as json, so two builds can be compared run against run. rt_bench_float
+// is the same harness built with RT_USE_FLOAT
+//
+// usage: rt_bench [--scene name,...] [--threads 1,2,4] [--spp n] [--depth n] [--width n]
+//                 [--seed n] [--out file.json]
+
+struct bench_scene {
+    std::string name;
+    std::function<scene(uint64_t)> build;
+};
+
+static std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty()) values.push_back(std::atoi(item.c_str()));
+    return values;
+}
+
+static bool listed(const std::string& list, const std::string& name) {
+    if (list.empty()) return true;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (item == name) return true;
+    return false;
+}
+
+// kilobytes on linux, bytes on macos
+static long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string scene_list, out_path;
+    std::vector<int> thread_counts;
+    int spp = 16, depth = 50, width = 400;
+    uint64_t seed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scene" && has_value) scene_list = argv[++i];
+        else if (arg == "--threads" && has_value) thread_counts = parse_list(argv[++i]);
+        else if (arg == "--spp" && has_value) spp = std::atoi(argv[++i]);
+        else if (arg == "--depth" && has_value) depth = std::atoi(argv[++i]);
+        else if (arg == "--width" && has_value) width = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value) seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--out" && has_value) out_path = argv[++i];
+        else {
+            std::cerr << "unknown argument: " << arg << '\n';
+            return 1;
+        }
+    }
+
+    // default sweep: powers of two up to the core count, plus the core count itself
+    if (thread_counts.empty()) {
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (int n = 1; n < cores; n *= 2)
+            thread_counts.push_back(n);
+        thread_counts.push_back(cores);
+    }
+
+    const std::vector<bench_scene> scenes = {
+        {"random_spheres", [](uint64_t s) { return random_spheres_scene(s); }},
+        {"dense_field",    [](uint64_t s) { return dense_field_scene(100000, s); }},
+        {"glass",          [](uint64_t s) { return glass_scene(s); }},
+        {"forest",         [](uint64_t s) { return forest_scene(1000000, s); }},
+        {"lights",         [](uint64_t s) { return lights_scene(s); }},
+    };
+
+    std::ostringstream json;
+    json << "{\n  \"spp\": " << spp << ",\n  \"max_depth\": " << depth
+         << ",\n  \"image_width\": " << width << ",\n  \"seed\": " << seed
+         << ",\n  \"precision\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double")
+         << "\",\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ",\n  \"scenes\": [";
+
+    bool first_scene = true;
+    for (const auto& entry : scenes) {
+        if (!listed(scene_list, entry.name))
+            continue;
+
+        auto build_start = std::chrono::steady_clock::now();
+        scene s = entry.build(seed);
+        double build_seconds = seconds_since(build_start);
+
+        json << (first_scene ? "" : ",") << "\n    {\n      \"name\": \"" << s.name
+             << "\",\n      \"primitives\": " << s.primitives
+             << ",\n      \"build_seconds\": " << build_seconds << ",\n      \"runs\": [";
+        first_scene = false;
+
+        for (size_t r = 0; r < thread_counts.size(); r++) {
+            camera& cam = s.cam;
+            cam.image_width  = width;
+            cam.thread_count = thread_counts[r];
+            cam.seed         = seed;
+            cam.output_path.clear();
+
+            // keep the renderer's own progress lines out of the json
+            std::streambuf* saved = std::cout.rdbuf(nullptr);
+            cam.render(s.world, spp, depth);
+            std::cout.rdbuf(saved);
+
+            const render_stats& stats = cam.stats();
+            double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+            std::cerr << s.name << " x" << thread_counts[r] << ": " << stats.seconds << "s, "
+                      << stats.rays / seconds / 1e6 << " Mrays/s\n";
+
+            json << (r ? "," : "") << "\n        {\n          \"threads\": " << thread_counts[r]
+                 << ",\n          \"wall_seconds\": " << stats.seconds
+                 << ",\n          \"samples\": " << stats.samples
+                 << ",\n          \"rays\": " << stats.rays
+                 << ",\n          \"samples_per_second\": " << stats.samples / seconds
+                 << ",\n          \"rays_per_second\": " << stats.rays / seconds
+                 << ",\n          \"peak_rss_kb\": " << peak_rss_kb()
+                 << ",\n          \"thread_seconds\": [";
+            for (size_t t = 0; t < stats.threads.size(); t++)
+                json << (t ? ", " : "") << stats.threads[t].busy_seconds;
+            json << "]\n        }";
+        }
+        json << "\n      ]\n    }";
+    }
+    json << "\n  ]\n}\n";
+
+    if (out_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(out_path);
+        out << json.str();
+        if (!out) {
+            std::cerr << "could not write " << out_path << '\n';
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "constants.h"
+
+// axis-aligned bounding box stored as one interval per axis
+class aabb {
+    public:
+        interval x, y, z;
+
+        aabb() {} // intervals default to empty, so the box is empty
+
+        aabb(const interval& x, const interval& y, const interval& z) : x(x), y(y), z(z) {}
+
+        // box spanned by two corner points, in any order
+        aabb(const point3& a, const point3& b) {
+            x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+            y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+            z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        }
+
+        aabb(const aabb& box0, const aabb& box1) {
+            x = interval(box0.x, box1.x);
+            y = interval(box0.y, box1.y);
+            z = interval(box0.z, box1.z);
+        }
+
+        const interval& axis_interval(int n) const {
+            if (n == 1) return y;
+            if (n == 2) return z;
+            return x;
+        }
+
+        bool is_empty() const {
+            return x.min > x.max || y.min > y.max || z.min > z.max;
+        }
+
+        point3 centroid() const {
+            return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+        }
+
+        int longest_axis() const {
+            if (x.size() > y.size())
+                return x.size() > z.size() ? 0 : 2;
+            return y.size() > z.size() ? 1 : 2;
+        }
+
+        real surface_area() const {
+            if (is_empty()) return 0;
+            auto dx = x.size(), dy = y.size(), dz = z.size();
+            return 2 * (dx*dy + dy*dz + dz*dx);
+        }
+
+        bool hit(const ray& r, interval ray_t) const {
+            vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+            return hit(r.origin(), inv_dir, ray_t);
+        }
+
+        // slab test with the reciprocal direction precomputed once per ray by the caller
+        bool hit(const point3& origin, const vec3& inv_dir, interval ray_t) const {
+            for (int axis = 0; axis < 3; axis++) {
+                const interval& ax = axis_interval(axis);
+                auto t0 = (ax.min - origin[axis]) * inv_dir[axis];
+                auto t1 = (ax.max - origin[axis]) * inv_dir[axis];
+
+                if (t0 > t1) std::swap(t0, t1);
+                t1 *= 1 + 2 * rounding_gamma(3); // rounding must never shrink the slab and open cracks
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+
+                if (ray_t.max < ray_t.min)
+                    return false;
+            }
+            return true;
+        }
+
+        static const aabb empty, universe;
+};
+
+const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
+const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+constexpr std::size_t cache_line_size = 64;
+
+// std::vector allocator that starts storage on a cache line boundary
+template <typename T, std::size_t alignment = cache_line_size>
+struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, alignment>; };
+
+    aligned_allocator() = default;
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, alignment>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, alignment>&) const { return false; }
+};
+
+#endif
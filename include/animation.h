@@ -0,0 +1,126 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "vec3.h"
+#include "line_reader.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// camera placement at one frame of an animation. frames between two keyframes are
+// interpolated linearly, frames outside them hold the nearest keyframe
+struct camera_keyframe {
+    int frame = 0;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov = 90;
+    double focus_dist = 10;
+};
+
+inline camera_keyframe keyframe_at(const std::vector<camera_keyframe>& keys, int frame) {
+    if (frame <= keys.front().frame) return keys.front();
+    if (frame >= keys.back().frame) return keys.back();
+
+    size_t k = 1;
+    while (keys[k].frame < frame) k++;
+    const camera_keyframe& a = keys[k - 1];
+    const camera_keyframe& b = keys[k];
+    double s = double(frame - a.frame) / (b.frame - a.frame);
+
+    camera_keyframe out;
+    out.frame = frame;
+    out.lookfrom = a.lookfrom + real(s) * (b.lookfrom - a.lookfrom);
+    out.lookat = a.lookat + real(s) * (b.lookat - a.lookat);
+    out.vfov = a.vfov + s * (b.vfov - a.vfov);
+    out.focus_dist = a.focus_dist + s * (b.focus_dist - a.focus_dist);
+    return out;
+}
+
+// output path of one frame. a run of '#' in the pattern is replaced by the zero-padded frame
+// number, e.g. shots/fly_####.png; without one the number goes before the extension
+inline std::string frame_path(const std::string& pattern, int frame) {
+    size_t first = pattern.find('#');
+    if (first != std::string::npos) {
+        size_t last = pattern.find_first_not_of('#', first);
+        size_t width = (last == std::string::npos ? pattern.size() : last) - first;
+        char number[32];
+        std::snprintf(number, sizeof(number), "%0*d", int(width), frame);
+        return pattern.substr(0, first) + number + pattern.substr(first + width);
+    }
+
+    char number[32];
+    std::snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = pattern.rfind('.');
+    size_t slash = pattern.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return pattern + number;
+    return pattern.substr(0, dot) + number + pattern.substr(dot);
+}
+
+// reads keyframes from a text file, '#' starting a comment:
+//     frame 0
+//     lookfrom 13 2 3
+//     lookat 0 0 0
+//     vfov 20
+//     focus_dist 10
+//     frame 120
+//     lookfrom -13 2 3
+// each 'frame' line starts a keyframe, which repeats any setting it leaves out from the one
+// before; the first starts from `start`. frames must be given in increasing order
+inline std::vector<camera_keyframe> read_keyframes(const std::string& path, const camera_keyframe& start) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot open keyframe file: " + path);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<camera_keyframe> keys;
+    std::istringstream lines(text);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(lines, line)) {
+        line_number++;
+        auto fail = [&](const std::string& what) {
+            return std::runtime_error(path + ":" + std::to_string(line_number) + ": " + what);
+        };
+
+        line_reader fields(line.data(), line.data() + line.size());
+        std::string_view key;
+        if (!fields.word(key) || key[0] == '#')
+            continue;
+
+        double x = 0, y = 0, z = 0;
+        bool ok = true;
+        if (key == "frame") {
+            ok = fields.number(x);
+            camera_keyframe next = keys.empty() ? start : keys.back();
+            next.frame = int(x);
+            if (ok && !keys.empty() && next.frame <= keys.back().frame)
+                throw fail("frames must increase");
+            keys.push_back(next);
+        } else if (keys.empty()) {
+            throw fail("'" + std::string(key) + "' before the first 'frame' line");
+        } else if (key == "lookfrom" || key == "lookat") {
+            ok = fields.number(x) && fields.number(y) && fields.number(z);
+            (key == "lookfrom" ? keys.back().lookfrom : keys.back().lookat) = point3(x, y, z);
+        } else if (key == "vfov" || key == "focus_dist") {
+            ok = fields.number(x);
+            (key == "vfov" ? keys.back().vfov : keys.back().focus_dist) = x;
+        } else {
+            throw fail("unknown keyword '" + std::string(key) + "'");
+        }
+
+        if (!ok || !fields.at_end())
+            throw fail("malformed '" + std::string(key) + "' line");
+    }
+
+    if (keys.empty())
+        throw std::runtime_error(path + ": no keyframes");
+    return keys;
+}
+
+#endif
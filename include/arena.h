@@ -0,0 +1,186 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "aligned_allocator.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// bump allocator: hands out memory from a few large cache-line aligned chunks and frees it all at
+// once. objects that need a destructor get it run on reset or when the arena goes away; arrays
+// are for trivially destructible types only. chunks are kept across resets, so an arena that is
+// reset and refilled with the same work stops calling malloc after the first round
+class arena {
+    public:
+        static constexpr std::size_t default_chunk_size = std::size_t(1) << 20;
+
+        explicit arena(std::size_t chunk_size = default_chunk_size) : chunk_size(chunk_size) {}
+
+        arena(arena&& other) noexcept { *this = std::move(other); }
+
+        arena& operator=(arena&& other) noexcept {
+            if (this != &other) {
+                reset();
+                chunks = std::move(other.chunks);
+                destructors = std::move(other.destructors);
+                chunk_size = other.chunk_size;
+                current = std::exchange(other.current, 0);
+                used = std::exchange(other.used, 0);
+                bytes_before_current = std::exchange(other.bytes_before_current, 0);
+                other.chunks.clear();
+                other.destructors.clear();
+            }
+            return *this;
+        }
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        ~arena() { reset(); }
+
+        void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+            while (current < chunks.size()) {
+                std::size_t start = used + padding(chunks[current].data.get() + used, alignment);
+                if (start + bytes <= chunks[current].size) {
+                    used = start + bytes;
+                    return chunks[current].data.get() + start;
+                }
+                next_chunk();
+            }
+
+            // chunks start on a cache line, so only larger alignments need room for padding
+            add_chunk(bytes + (alignment > cache_line_size ? alignment : 0));
+            std::size_t start = padding(chunks[current].data.get(), alignment);
+            used = start + bytes;
+            return chunks[current].data.get() + start;
+        }
+
+        // makes sure the next `bytes` (alignment padding included) come from one chunk, so
+        // allocations that are used together end up next to each other
+        void reserve(std::size_t bytes) {
+            while (current < chunks.size() && used + bytes > chunks[current].size)
+                next_chunk();
+            if (current == chunks.size())
+                add_chunk(bytes);
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>)
+                destructors.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+            return object;
+        }
+
+        // count default-initialized elements, aligned to at least `alignment`
+        template <typename T>
+        T* make_array(std::size_t count, std::size_t alignment = alignof(T)) {
+            static_assert(std::is_trivially_destructible_v<T>, "arena arrays are released without destructors");
+            if (count == 0) return nullptr;
+            T* first = static_cast<T*>(allocate(count * sizeof(T), std::max(alignment, alignof(T))));
+            for (std::size_t k = 0; k < count; k++)
+                new (first + k) T;
+            return first;
+        }
+
+        // copies of count elements, e.g. to give a table its final place next to the data using it
+        template <typename T>
+        T* copy_array(const T* source, std::size_t count, std::size_t alignment = alignof(T)) {
+            static_assert(std::is_trivially_destructible_v<T>, "arena arrays are released without destructors");
+            if (count == 0) return nullptr;
+            T* first = static_cast<T*>(allocate(count * sizeof(T), std::max(alignment, alignof(T))));
+            std::uninitialized_copy(source, source + count, first);
+            return first;
+        }
+
+        // position to rewind to, releasing everything allocated after it. only arrays may be
+        // allocated between mark and rewind
+        struct marker {
+            std::size_t chunk;
+            std::size_t used;
+            std::size_t bytes_before;
+        };
+
+        marker mark() const { return marker{current, used, bytes_before_current}; }
+
+        void rewind(const marker& m) {
+            current = m.chunk;
+            used = m.used;
+            bytes_before_current = m.bytes_before;
+        }
+
+        // frees every object and array but keeps the chunks for the next round
+        void reset() {
+            for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+                it->destroy(it->object);
+            destructors.clear();
+            current = 0;
+            used = 0;
+            bytes_before_current = 0;
+        }
+
+        // bytes handed out, including alignment padding, and bytes held in chunks
+        std::size_t bytes_used() const { return bytes_before_current + used; }
+
+        std::size_t bytes_reserved() const {
+            std::size_t total = 0;
+            for (const auto& c : chunks)
+                total += c.size;
+            return total;
+        }
+
+    private:
+        static std::size_t padding(const std::byte* p, std::size_t alignment) {
+            return (alignment - reinterpret_cast<std::uintptr_t>(p) % alignment) % alignment;
+        }
+
+        void next_chunk() {
+            bytes_before_current += used;
+            used = 0;
+            current++;
+        }
+
+        void add_chunk(std::size_t bytes) {
+            std::size_t size = std::max(chunk_size, bytes);
+            chunks.push_back(chunk{std::unique_ptr<std::byte[], chunk_deleter>(
+                static_cast<std::byte*>(::operator new(size, std::align_val_t(cache_line_size)))), size});
+            current = chunks.size() - 1;
+            used = 0;
+        }
+
+        struct chunk_deleter {
+            void operator()(std::byte* p) const { ::operator delete(p, std::align_val_t(cache_line_size)); }
+        };
+
+        struct chunk {
+            std::unique_ptr<std::byte[], chunk_deleter> data;
+            std::size_t size;
+        };
+
+        struct destructor {
+            void* object;
+            void (*destroy)(void*);
+        };
+
+        std::vector<chunk> chunks;
+        std::vector<destructor> destructors;
+        std::size_t chunk_size = default_chunk_size;
+        std::size_t current = 0;              // chunk being filled
+        std::size_t used = 0;                 // bytes taken from it
+        std::size_t bytes_before_current = 0; // bytes taken from the chunks before it
+};
+
+// per-thread scratch memory for data that lives no longer than one tile, such as wavefront ray
+// batches and hit queues. the camera resets it when a thread starts a tile
+inline arena& thread_scratch() {
+    static thread_local arena scratch;
+    return scratch;
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// bounding volume hierarchy over an arbitrary set of primitive boxes.
+// the tree is built top-down with binned SAH splits and stored flattened in depth-first order:
+// an interior node's first child directly follows it and the second child sits at `offset`.
+// primitives are referenced through `indices`, which the build sorts into leaf order.
+// a build on several threads gives the same tree as one on a single thread.
+class bvh_tree {
+    public:
+        struct node {
+            aabb bbox;
+            int offset; // leaf: first entry in indices, interior: index of the second child
+            int count;  // number of primitives in a leaf, 0 for interior nodes
+            int axis;   // split axis, used to visit the nearer child first
+        };
+
+        std::vector<node> nodes;
+        std::vector<int> indices;
+
+        static constexpr int max_depth = 64;
+
+        // leaf_width is how many primitives a leaf tests for the price of one, e.g. the SIMD lane
+        // count when leaves are intersected a block at a time. threads is how many may work on the build
+        void build(const std::vector<aabb>& boxes, int max_leaf_size = 4, int leaf_width = 1, int threads = 1) {
+            nodes.clear();
+            indices.resize(boxes.size());
+            if (boxes.empty()) return;
+
+            // the build partitions copies of the boxes rather than indices into them, so every pass
+            // over a node's range streams through memory instead of gathering from all over boxes
+            threads = std::max(1, threads);
+            prims.resize(boxes.size());
+            parallel_chunks(boxes.size(), threads, [&](int, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    prims[i] = build_prim{boxes[i], int(i)};
+            });
+
+            nodes.reserve(2 * boxes.size());
+            this->leaf_width = std::max(1, leaf_width);
+            RT_SCOPE("bvh build");
+            build_recursive(nodes, 0, int(boxes.size()), range_bounds(0, int(boxes.size())), 0, max_leaf_size, threads);
+
+            parallel_chunks(prims.size(), threads, [&](int, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    indices[i] = prims[i].index;
+            });
+            prims.clear();
+            prims.shrink_to_fit();
+            // the reserve above covers one primitive per leaf; wide leaves need far fewer nodes
+            nodes.shrink_to_fit();
+        }
+
+        aabb bounds() const {
+            return nodes.empty() ? aabb::empty : nodes[0].bbox;
+        }
+
+        // walks every leaf whose box the ray enters, nearest child first. hit_leaf(first, count, ray_t)
+        // tests indices[first, first + count) and returns true on a hit after shrinking ray_t.max to it,
+        // so boxes behind the closest hit so far are culled.
+        template <typename leaf_fn>
+        bool traverse(const ray& r, interval ray_t, leaf_fn&& hit_leaf) const {
+            if (nodes.empty()) return false;
+
+            const vec3& dir = r.direction();
+            vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+            bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+            int stack[max_depth];
+            int stack_size = 0;
+            int current = 0;
+            bool hit_anything = false;
+
+            while (true) {
+                const node& n = nodes[current];
+                RT_COUNT(node_visits);
+                if (n.bbox.hit(r.origin(), inv_dir, ray_t)) {
+                    if (n.count > 0) {
+                        if (hit_leaf(n.offset, n.count, ray_t))
+                            hit_anything = true;
+                        if (stack_size == 0) break;
+                        current = stack[--stack_size];
+                    } else if (dir_is_neg[n.axis]) {
+                        stack[stack_size++] = current + 1;
+                        current = n.offset;
+                    } else {
+                        stack[stack_size++] = n.offset;
+                        current = current + 1;
+                    }
+                } else {
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+            }
+
+            return hit_anything;
+        }
+
+    private:
+        static constexpr int sah_bins = 16;
+        // a subtree smaller than this is not worth a thread of its own
+        static constexpr int min_parallel_prims = 1 << 15;
+
+        struct build_prim {
+            aabb box;
+            int index;
+
+            real centroid(int axis) const {
+                const interval& extent = box.axis_interval(axis);
+                return 0.5 * (extent.min + extent.max);
+            }
+        };
+
+        std::vector<build_prim> prims;
+        int leaf_width = 1;
+
+        // intersection cost of a run of primitives, in units of one primitive test
+        double prim_cost(int count) const {
+            return double((count + leaf_width - 1) / leaf_width);
+        }
+
+        int make_leaf(std::vector<node>& out, const aabb& bbox, int start, int end) {
+            out.push_back(node{bbox, start, end - start, 0});
+            return int(out.size()) - 1;
+        }
+
+        // box around a run of primitives, and around their centroids
+        struct build_bounds {
+            aabb box;
+            aabb centroids;
+
+            void add(const aabb& prim_box, const point3& c) {
+                box = aabb(box, prim_box);
+                centroids = aabb(centroids, aabb(c, c));
+            }
+            void add(const build_bounds& other) {
+                box = aabb(box, other.box);
+                centroids = aabb(centroids, other.centroids);
+            }
+        };
+
+        build_bounds range_bounds(int start, int end) const {
+            build_bounds b;
+            for (int i = start; i < end; i++)
+                b.add(prims[i].box, prims[i].box.centroid());
+            return b;
+        }
+
+        // the bounds of a node's range come from its parent, which gathers them per bin while
+        // choosing the split, so each level costs one binning and one partition pass.
+        // nodes are appended to out; the children's ranges of prims are disjoint, so while threads
+        // are left the second child is built on another one
+        int build_recursive(std::vector<node>& out, int start, int end, const build_bounds& range, int depth,
+                            int max_leaf_size, int threads) {
+            const aabb& bbox = range.box;
+            const aabb& centroid_bounds = range.centroids;
+
+            int count = end - start;
+            // the traversal stack holds at most one entry per level
+            if (count == 1 || depth >= max_depth - 1)
+                return make_leaf(out, bbox, start, end);
+
+            int axis = centroid_bounds.longest_axis();
+            const interval& extent = centroid_bounds.axis_interval(axis);
+
+            int mid;
+            build_bounds left, right;
+            bool have_child_bounds = false;
+            if (extent.size() <= 0) {
+                // every centroid coincides, so no plane separates them; halve the range to keep leaves small
+                if (count <= max_leaf_size)
+                    return make_leaf(out, bbox, start, end);
+                mid = start + count / 2;
+            } else {
+                build_bounds bin_bounds[sah_bins];
+                int bin_counts[sah_bins] = {};
+                auto bin_scale = sah_bins / extent.size();
+
+                auto bin_of = [&](const build_prim& prim) {
+                    int b = int((prim.centroid(axis) - extent.min) * bin_scale);
+                    return b < sah_bins ? b : sah_bins - 1;
+                };
+
+                for (int i = start; i < end; i++) {
+                    int b = bin_of(prims[i]);
+                    bin_counts[b]++;
+                    bin_bounds[b].add(prims[i].box, prims[i].box.centroid());
+                }
+
+                // sweep from the right to get the area and count above every candidate plane
+                double right_area[sah_bins - 1];
+                int right_count[sah_bins - 1];
+                aabb right_box;
+                int right_total = 0;
+                for (int b = sah_bins - 1; b > 0; b--) {
+                    right_box = aabb(right_box, bin_bounds[b].box);
+                    right_total += bin_counts[b];
+                    right_area[b - 1] = right_box.surface_area();
+                    right_count[b - 1] = right_total;
+                }
+
+                // cost relative to one primitive intersection, with one unit for the extra node visit
+                double best_cost = infinity;
+                int best_split = -1;
+                aabb left_box;
+                int left_total = 0;
+                for (int b = 0; b < sah_bins - 1; b++) {
+                    left_box = aabb(left_box, bin_bounds[b].box);
+                    left_total += bin_counts[b];
+                    if (left_total == 0 || right_count[b] == 0) continue;
+                    double cost = prim_cost(left_total) * left_box.surface_area() + prim_cost(right_count[b]) * right_area[b];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_split = b;
+                    }
+                }
+
+                auto parent_area = bbox.surface_area();
+                double split_cost = 1.0 + (parent_area > 0 ? best_cost / parent_area : 0);
+                if (count <= max_leaf_size && prim_cost(count) <= split_cost)
+                    return make_leaf(out, bbox, start, end);
+
+                if (best_split < 0) {
+                    mid = start + count / 2;
+                } else {
+                    auto first_right = std::partition(prims.begin() + start, prims.begin() + end,
+                        [&](const build_prim& prim) { return bin_of(prim) <= best_split; });
+                    mid = int(first_right - prims.begin());
+                    for (int b = 0; b < sah_bins; b++)
+                        (b <= best_split ? left : right).add(bin_bounds[b]);
+                    have_child_bounds = true;
+                }
+            }
+
+            if (!have_child_bounds) {
+                left = range_bounds(start, mid);
+                right = range_bounds(mid, end);
+            }
+
+            int index = int(out.size());
+            out.push_back(node{bbox, 0, 0, axis});
+            if (threads < 2 || end - mid < min_parallel_prims) {
+                build_recursive(out, start, mid, left, depth + 1, max_leaf_size, threads);
+                int second = build_recursive(out, mid, end, right, depth + 1, max_leaf_size, threads);
+                out[index].offset = second;
+                return index;
+            }
+
+            // the second child's nodes are built apart and appended after the first child's, with
+            // their child offsets moved along, which is where a single thread would have put them
+            std::vector<node> second_nodes;
+            std::exception_ptr second_error;
+            std::thread second_builder([&] {
+                try {
+                    build_recursive(second_nodes, mid, end, right, depth + 1, max_leaf_size, threads / 2);
+                } catch (...) {
+                    second_error = std::current_exception();
+                }
+            });
+            try {
+                build_recursive(out, start, mid, left, depth + 1, max_leaf_size, threads - threads / 2);
+            } catch (...) {
+                second_builder.join();
+                throw;
+            }
+            second_builder.join();
+            if (second_error)
+                std::rethrow_exception(second_error);
+
+            int second = int(out.size());
+            for (node n : second_nodes) {
+                if (n.count == 0) n.offset += second;
+                out.push_back(n);
+            }
+            out[index].offset = second;
+            return index;
+        }
+};
+
+// hittable wrapper that replaces the linear scan of a hittable_list with a bvh_tree over its objects
+class bvh : public hittable {
+    public:
+        bvh(const hittable_list& list) : bvh(list.objects) {}
+
+        bvh(const std::vector<shared_ptr<hittable>>& src_objects) {
+            std::vector<aabb> boxes;
+            boxes.reserve(src_objects.size());
+            for (const auto& object : src_objects)
+                boxes.push_back(object->bounding_box());
+
+            tree.build(boxes);
+
+            // store the objects in leaf order so a leaf is a contiguous run
+            objects.reserve(src_objects.size());
+            for (int index : tree.indices)
+                objects.push_back(src_objects[index]);
+            tree.indices.clear();
+            tree.indices.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return tree.traverse(r, ray_t, [&](int first, int count, interval& t) {
+                bool hit_anything = false;
+                for (int i = first; i < first + count; i++) {
+                    if (objects[i]->hit(r, t, rec)) {
+                        hit_anything = true;
+                        t.max = rec.t;
+                    }
+                }
+                return hit_anything;
+            });
+        }
+
+        aabb bounding_box() const override { return tree.bounds(); }
+
+    private:
+        bvh_tree tree;
+        std::vector<shared_ptr<hittable>> objects;
+};
+
+#endif
@@ -2,13 +2,86 @@
 #define CAMERA_H
 
 #include "hittable.h"
+#include "hittable_list.h"
 #include "material.h"
+#include "sampler.h"
 #include <iostream>
 #include <thread>
+#include <chrono>
 #include "image_buffer.h"
+#include "image_output.h"
+#include "tile_scheduler.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "preview.h"
+#include "denoise.h"
+#include "animation.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include <atomic>
+#include <condition_variable>
 #include <mutex> 
+#include <sys/wait.h>
 
 std::mutex cout_mutex; // Global mutex for serializing std::cout access
+std::atomic<bool> render_interrupted{false}; // set from a signal handler to stop after the current tiles
+
+// how camera turns a primary ray into radiance. all three evaluate the same estimator:
+//   recursive  - ray_color, one call per bounce
+//   iterative  - trace_path, a loop carrying the path throughput
+//   wavefront  - a tile's paths are traced together one bounce at a time: every live path is
+//                extended (intersected), misses are connected to the sky, and hits are shaded
+//                grouped by material type
+// at every diffuse hit the estimator also samples the lights directly (next-event estimation)
+// and weights that against finding the same light by scattering, see camera::lights
+enum class integrator_type { recursive, iterative, wavefront };
+
+// totals of the last render call, per thread and overall. each thread's entry lists the
+// timing of every tile it rendered
+struct render_stats {
+    double seconds = 0;
+    long long samples = 0;
+    long long rays = 0;
+    std::vector<thread_utilization> threads;
+};
+
+// one in-flight path of the wavefront integrator, carrying its own random stream so the
+// path sees exactly the numbers it would get when traced on its own
+struct path_state {
+    ray r;
+    color throughput;
+    color radiance;
+    double scatter_pdf; // density r was scattered with, 0 for camera rays and specular bounces
+    sampler samples;
+    rng random;
+};
+
+// running estimate for one pixel; the luminance moments drive adaptive sampling
+struct pixel_estimate {
+    color sum;
+    double lum_sum = 0;
+    double lum_sq_sum = 0;
+    int count = 0;
+
+    void add(const color& c) {
+        sum += c;
+        double lum = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        lum_sum += lum;
+        lum_sq_sum += lum * lum;
+        count++;
+    }
+};
+
+// rays traced by the current thread, folded into its thread_utilization after every tile
+struct path_counters {
+    long long samples = 0;
+    long long rays = 0;
+};
+
+inline path_counters& thread_path_counters() {
+    static thread_local path_counters counters;
+    return counters;
+}
 
 class camera {
     public:
@@ -25,62 +98,338 @@ class camera {
         double defocus_angle = 0;
         double focus_dist = 10;
 
+        std::string output_path = "image.ppm"; // format follows the extension: .ppm, .png or .pfm; empty writes nothing
+
+        int tile_size = 16;   // edge length in pixels of the tiles handed to render threads
+        int thread_count = 0; // 0 uses std::thread::hardware_concurrency()
+
+        // render threads are started on first use and kept for later render calls. with
+        // pin_threads each is bound to a core, spread over the NUMA nodes (see placement_cpus)
+        bool pin_threads = false;
+
+        uint64_t seed = 0; // base seed for the per-sample random streams
+
+        // where the pixel, lens, scattering and light sampling numbers come from, see sampler_type
+        sampler_type sampling = sampler_type::sobol;
+
+        integrator_type integrator = integrator_type::recursive;
+        int wavefront_batch = 4096; // paths traced together per wavefront pass
+
+        // adaptive sampling: after min_samples, and then every adaptive_step samples, a pixel stops
+        // once the 95% confidence interval of its mean is within noise_threshold in display
+        // (gamma) space. the samples_per_pixel passed to render is the upper limit
+        bool adaptive_sampling = false;
+        int min_samples = 16;
+        int adaptive_step = 16;
+        double noise_threshold = 0.01;
+
+        // paths that have scattered this many times are continued with probability equal to
+        // their throughput (at most 0.95) and reweighted to stay unbiased. 0 disables it
+        int russian_roulette_depth = 0;
+
+        // emissive objects sampled for direct light: at every diffuse hit a shadow ray goes to a
+        // point drawn from lights (one object picked uniformly, then hittable::random), and light
+        // that a scattered ray finds is weighted against that strategy with the power heuristic.
+        // an emitter left out of lights is still found by scattering, only more noisily
+        hittable_list lights;
+        bool next_event_estimation = true;
+
+        // rays leaving the scene see the sky gradient, or background when sky is off, e.g. a
+        // black background for scenes lit only by their emitters
+        bool sky = true;
+        color background = color(0,0,0);
+
+        // denoising: once the samples are in, a feature pass traces aov_samples camera rays per
+        // pixel for its albedo, normal and depth, and denoise_filter runs over the image guided by
+        // them before it is written. the output, and progressive previews, show the filtered image;
+        // checkpoints keep the raw sums
+        bool denoise = false;
+        int aov_samples = 8;
+        denoiser denoise_filter;
+
+        // how the image is mapped to 8-bit display values when it is written (tone_map.h). the
+        // render itself only accumulates linear radiance, which .pfm outputs and checkpoints keep
+        tone_mapping tone;
+
+        // progressive mode renders the whole image in passes of pass_samples samples per pixel,
+        // accumulating float sums in the image_buffer. every checkpoint_interval seconds the sums
+        // are saved to checkpoint_path, which a later run with the same settings resumes from,
+        // and every preview_interval seconds the current average is written to preview_path
+        bool progressive = false;
+        int pass_samples = 16;
+        std::string checkpoint_path;
+        double checkpoint_interval = 60;
+        std::string preview_path;
+        double preview_interval = 10;
+
+        // distributed mode: render hands the tiles to worker processes over tcp instead of its
+        // own threads. local_workers copies of this process are forked to serve as workers, and
+        // with listen_port set, workers on other machines may join with render_worker. a tile
+        // whose worker dies, or is silent for tile_timeout seconds, is given to another worker
+        int local_workers = 0;
+        int listen_port = 0;
+        double tile_timeout = 600;
+
+        const render_stats& stats() const { return last_stats; }
+
         void render(const hittable& world, int samples_per_pixel, int max_depth) {
+            RT_SCOPE("render");
             initialize();
-            // std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-            image_buffer image(image_height, image_width);
-            std::vector<std::thread> threads;
-            int start_row = 0;
-            int end_row;
+            if (progressive) {
+                if (local_workers > 0 || listen_port > 0)
+                    throw std::invalid_argument("progressive rendering cannot be distributed");
+                render_progressive(world, samples_per_pixel, max_depth);
+                return;
+            }
+            if (local_workers > 0 || listen_port > 0) {
+                render_distributed(world, samples_per_pixel, max_depth);
+                return;
+            }
 
-            std::cout << "Number of threads: " << num_threads << '\n';
+            // a denoised image is only known once every tile is in, so it is not streamed
+            image_buffer image(image_height, image_width, denoise);
+            std::unique_ptr<image_output> output;
+            if (!output_path.empty() && !denoise)
+                output = std::make_unique<image_output>(output_path, make_image_writer(output_path, tone), image, tile_size);
+            tile_scheduler scheduler(image_width, image_height, tile_size);
+            std::vector<thread_utilization> utilization(num_threads);
 
-            // std::cout << "image height: " << image_height << " image width: " << image_width << '\n';
+            std::cout << "Number of threads: " << num_threads << ", tiles: " << scheduler.tile_count() << '\n';
 
-            double pss = 1.0 / samples_per_pixel;
+            auto render_start = std::chrono::steady_clock::now();
 
-            for (int i = 0; i < num_threads; ++i) {
-                start_row = i * rows_per_thread;
-                end_row = start_row + rows_per_thread;
-                if (i == num_threads - 1) {
-                    end_row += remainder; // Last thread takes the remaining rows
-                }
+            run_tiles(scheduler, utilization, [&](const tile& t) {
+                render_tile(t, image, world, samples_per_pixel, max_depth);
+                if (output)
+                    output->tile_done(t);
+            }, render_start);
 
-                // std::cout << "start " << start_row << " end " << end_row << " assigned to thread" << i + 1 << '\n' << std::flush;
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - render_start;
+            report_utilization(utilization, wall.count());
 
-                if (start_row < end_row) {
-                    try {
-                        threads.push_back(std::thread([this, start_row, end_row, &image, &world, samples_per_pixel, max_depth, pss]() {
-                            try {
-                                render_chunk(start_row, end_row, image, world, samples_per_pixel, max_depth, pss);
-                            } catch (const std::exception& e) {
-                                std::cerr << "Exception in thread " << std::this_thread::get_id() << ": " << e.what() << '\n';
-                            }
-                        }));
+            if (output) {
+                output->finish();
+                std::cout << "Image written to " << output_path << '\n';
+            } else if (denoise && !output_path.empty()) {
+                write_image(output_path, denoised_image(world, image, samples_per_pixel, max_depth), tone);
+                std::cout << "Image written to " << output_path << '\n';
+            }
 
-                        // std::cout << "Thread " << i + 1 << " added to the vector.\n";
-                    } catch (const std::exception& e) {
-                        std::cerr << "Error creating thread " << i << ": " << e.what() << '\n';
-                        return; // Exit the function if thread creation fails
+            std::clog << "\rDone.                          \n";
+        }
+
+        // renders every frame from the first keyframe to the last into numbered files named after
+        // output_path (see frame_path). the render threads stay up for the whole sequence; once
+        // every tile of a frame is rendered they start on the next one while the finished frame is
+        // still being encoded and written. the world and its trees are built once by the caller
+        void render_animation(const hittable& world, int samples_per_pixel, int max_depth, const std::vector<camera_keyframe>& keys) {
+            if (progressive || local_workers > 0 || listen_port > 0)
+                throw std::invalid_argument("animations are rendered single-shot on local threads");
+            if (denoise)
+                throw std::invalid_argument("animation frames are streamed to disk and cannot be denoised");
+            if (output_path.empty())
+                throw std::invalid_argument("an animation needs an output path");
+            initialize();
+
+            // two frames are in flight at most: one rendering, one finishing its encode
+            image_buffer buffers[2] = {image_buffer(image_height, image_width),
+                                       image_buffer(image_height, image_width)};
+            std::unique_ptr<image_output> outputs[2];
+
+            std::mutex frame_mutex;
+            std::condition_variable frame_changed;
+            int generation = 0;    // bumped when a new frame's tiles are ready
+            unsigned int busy = 0; // render threads still working on the current frame
+            bool finished = false;
+            std::exception_ptr frame_error; // set when a tile throws; no later frame is started
+            std::unique_ptr<tile_scheduler> scheduler;
+            image_buffer* image = nullptr;
+            image_output* output = nullptr;
+
+            std::vector<thread_utilization> utilization(num_threads);
+            auto render_one = [&](const tile& t) {
+                render_tile(t, *image, world, samples_per_pixel, max_depth);
+                output->tile_done(t);
+            };
+
+            auto render_start = std::chrono::steady_clock::now();
+            thread_pool& threads = workers();
+            threads.start([&](unsigned int i) {
+                int seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(frame_mutex);
+                        frame_changed.wait(lock, [&] { return finished || generation != seen; });
+                        if (finished) return;
+                        seen = generation;
+                    }
+                    try {
+                        drain_tiles(*scheduler, utilization[i], render_one, render_start);
+                    } catch (...) {
+                        // the frame is given up on: its remaining tiles are dropped, and the loop
+                        // below stops at it and rethrows the error once every thread is back. the
+                        // thread stays in the job so the busy count and the pool agree
+                        std::lock_guard<std::mutex> lock(frame_mutex);
+                        if (!frame_error)
+                            frame_error = std::current_exception();
+                        scheduler->cancel();
                     }
+                    std::lock_guard<std::mutex> lock(frame_mutex);
+                    if (--busy == 0)
+                        frame_changed.notify_all();
+                }
+            });
+            int first_frame = keys.front().frame, last_frame = keys.back().frame;
+            int frames = 0;
+            for (int frame = first_frame; frame <= last_frame && !render_interrupted; frame++) {
+                RT_SCOPE("frame");
+                auto frame_start = std::chrono::steady_clock::now();
+                int slot = frame & 1;
+                std::string path = frame_path(output_path, frame);
 
-                } else {
-                    std::cerr << "Invalid range for thread " << i << ": start_row = " << start_row << ", end_row = " << end_row << '\n';
-                    return;
+                // the slot's previous frame was finished before the frame after it started
+                buffers[slot].clear_accum();
+                outputs[slot] = std::make_unique<image_output>(path, make_image_writer(path, tone), buffers[slot], tile_size);
+
+                {
+                    std::lock_guard<std::mutex> lock(frame_mutex);
+                    camera_keyframe key = keyframe_at(keys, frame);
+                    lookfrom = key.lookfrom;
+                    lookat = key.lookat;
+                    vfov = key.vfov;
+                    focus_dist = key.focus_dist;
+                    update_view();
+
+                    scheduler = std::make_unique<tile_scheduler>(image_width, image_height, tile_size);
+                    image = &buffers[slot];
+                    output = outputs[slot].get();
+                    busy = num_threads;
+                    generation++;
                 }
-            }
+                frame_changed.notify_all();
 
-            // std::cout << "time to execute threads \n";
+                // the previous frame's encode overlaps this frame's rendering
+                if (outputs[slot ^ 1]) {
+                    outputs[slot ^ 1]->finish();
+                    outputs[slot ^ 1].reset();
+                }
 
-            for (auto& t : threads) {
-                t.join();
+                {
+                    std::unique_lock<std::mutex> lock(frame_mutex);
+                    frame_changed.wait(lock, [&] { return busy == 0 || frame_error; });
+                    if (frame_error)
+                        break;
+                }
+                frames++;
+                std::chrono::duration<double> frame_time = std::chrono::steady_clock::now() - frame_start;
+                std::cout << "Frame " << frame << " rendered in " << frame_time.count() << "s -> " << path << '\n';
             }
 
-            image.write_to_ppm();
+            {
+                std::lock_guard<std::mutex> lock(frame_mutex);
+                finished = true;
+            }
+            frame_changed.notify_all();
+            threads.wait();
+            if (frame_error)
+                std::rethrow_exception(frame_error);
+            for (auto& o : outputs)
+                if (o) o->finish();
 
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - render_start;
+            report_utilization(utilization, wall.count());
+            std::cout << frames << " frames, " << wall.count() / std::max(1, frames) << "s per frame\n";
+            std::clog << "\rDone.                          \n";
+        }
+
+        // serves a coordinator at host:port: renders the tiles it hands out until it has none
+        // left. each of the camera's threads keeps its own connection, and all of them share
+        // one image buffer, a tile at a time (worker_tile_claims). the scene, camera and render
+        // settings must match the coordinator's, which it checks before handing out tiles
+        void render_worker(const hittable& world, int samples_per_pixel, int max_depth, const std::string& host, int port) {
+            initialize();
+            image_buffer image(image_height, image_width);
+            worker_tile_claims claims;
+            auto hello = make_distributed_hello(image_width, image_height, seed, estimator(samples_per_pixel, max_depth), world.bounding_box());
+
+            std::atomic<int> tiles_done{0};
+            workers().run([&](unsigned int) {
+                int fd = connect_to(host, port, 10);
+                try {
+                    if (!send_all(fd, &hello, sizeof(hello)))
+                        throw std::runtime_error("coordinator closed the connection");
+                    tile_job job;
+                    while (recv_all(fd, &job, sizeof(job)) && job.x0 >= 0) {
+                        tile t{job.x0, job.y0, job.x1, job.y1};
+                        auto tile_start = std::chrono::steady_clock::now();
+                        if (claims.claim(t)) {
+                            // render_tile resumes from the sums already in the buffer, which an
+                            // earlier render of the tile that threw may have left half done
+                            try {
+                                image.clear_accum(t);
+                                render_tile(t, image, world, samples_per_pixel, max_depth);
+                            } catch (...) {
+                                claims.release(t, false);
+                                throw;
+                            }
+                            claims.release(t, true);
+                        }
+                        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tile_start;
+
+                        auto& counters = thread_path_counters();
+                        tile_result_header header{job, counters.samples, counters.rays, elapsed.count()};
+                        counters = path_counters();
+                        if (!send_all(fd, &header, sizeof(header)) || !send_tile_pixels(fd, image, t))
+                            break;
+                        tiles_done++;
+                    }
+                } catch (...) {
+                    ::close(fd);
+                    throw;
+                }
+                ::close(fd);
+            });
+            std::cout << "Worker rendered " << tiles_done << " tiles\n";
+        }
+
+        // interactive preview: serves one viewer at a time on 127.0.0.1:port (preview.h). a view
+        // sent by the viewer cancels the passes in flight, and the camera starts over from it with
+        // a coarse pass, then passes of 1, 2, 4, ... samples per pixel (at most pass_samples) until
+        // samples_per_pixel. every tile goes to the viewer as soon as it is rendered
+        void render_preview(const hittable& world, int samples_per_pixel, int max_depth, int port) {
+            if (local_workers > 0 || listen_port > 0)
+                throw std::invalid_argument("the preview renders on local threads");
+            initialize();
+
+            int listen_fd = listen_on(port, true);
+            std::cout << "Preview listening on 127.0.0.1:" << port << '\n';
+            try {
+                while (!render_interrupted) {
+                    pollfd p{listen_fd, POLLIN, 0};
+                    if (::poll(&p, 1, 200) <= 0 || !(p.revents & POLLIN))
+                        continue;
+                    int fd = ::accept(listen_fd, nullptr, nullptr);
+                    if (fd < 0) continue;
+                    int on = 1;
+                    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                    std::cout << "Viewer connected\n";
+                    try {
+                        serve_preview(fd, world, samples_per_pixel, max_depth);
+                    } catch (...) {
+                        ::close(fd);
+                        throw;
+                    }
+                    ::close(fd);
+                    std::cout << "Viewer disconnected\n";
+                }
+            } catch (...) {
+                ::close(listen_fd);
+                throw;
+            }
+            ::close(listen_fd);
             std::clog << "\rDone.                          \n";
         }
-    
     
     private:
         int image_height;
@@ -92,30 +441,31 @@ class camera {
         vec3 defocus_disk_u;
         vec3 defocus_disk_v;
         unsigned int num_threads;
-        int rows_per_thread;
-        int remainder;
-        double pixel_samples_scale;
+        render_stats last_stats;
+        std::unique_ptr<thread_pool> pool;
+        int pass_size = 0; // samples per pixel one progressive or preview pass adds, 0 for single-shot
 
         void initialize() {
             image_height = int(image_width / aspect_ratio);
             image_height = (image_height < 1) ? 1 : image_height;
 
+            num_threads = thread_count > 0 ? thread_count : std::thread::hardware_concurrency();
+            num_threads = (num_threads < 1) ? 1 : num_threads;
+
+            std::cout << "Using " << num_threads << " threads \n";
+
+            pass_size = 0;
+            update_view();
+        }
+
+        // the ray setup that follows from lookfrom, lookat, vup, vfov and the focus settings
+        void update_view() {
             // auto focal_length = (lookfrom - lookat).length();
             auto theta = degrees_to_radians(vfov);
             auto h = std::tan(theta / 2);
             auto viewport_height = 2 * h * focus_dist;
             auto viewport_width = viewport_height * (double (image_width) / image_height);
 
-            pixel_samples_scale = 1.0 / samples_per_pixel;
-
-            num_threads = std::thread::hardware_concurrency();
-
-            rows_per_thread = image_height / num_threads;
-            remainder = image_height % rows_per_thread; 
-
-            std::cout << "Using " << num_threads << " threads \n";
-
-            // std::cout << "pixel sample scale is " << pixel_samples_scale << '\n';
             center = lookfrom;
 
             w = unit_vector(lookfrom - lookat);
@@ -137,68 +487,1002 @@ class camera {
             defocus_disk_v = v * defocus_radius;
         }
         
-        ray get_ray(int i, int j) {
+        // camera ray of the sample s was started on; the pixel position and the lens always
+        // take the sampler's first four dimensions
+        ray get_ray(int i, int j, sampler& s) {
 
-            auto offset = sample_square();
+            auto offset = sample_square(s.get_2d());
 
             auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
-            auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+            sample2 lens = s.get_2d();
+            auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens);
             auto ray_direction = pixel_sample - ray_origin;
 
             return ray(ray_origin, ray_direction);
         }
 
-        vec3 sample_square() const {
-            return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        // one per render call; it draws the same numbers for a pixel sample whichever thread asks
+        sampler make_sampler(int samples_per_pixel) const {
+            return sampler(sampling, seed, samples_per_pixel, image_width);
         }
 
-        point3 defocus_disk_sample() {
-            auto p = random_in_unit_disk();
+        vec3 sample_square(const sample2& u) const {
+            return vec3(real(u.u - 0.5), real(u.v - 0.5), 0);
+        }
+
+        point3 defocus_disk_sample(const sample2& u) {
+            auto p = sample_unit_disk(u);
             return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world) {
+        color ray_color(const ray& r, int depth, const hittable& world, sampler& s, int bounce = 0,
+                        color throughput = color(1,1,1), double scatter_pdf = 0) {
             if (depth <= 0) {
+                RT_PATH_END(bounce, true);
                 return color(0,0,0);
             }
             hit_record rec;
+            thread_path_counters().rays++;
+
+            if (RT_TIMED(intersect, world.hit(r, interval(0, infinity), rec))) {
+                RT_COUNT_HIT(rec.mat->type());
+                s.start_bounce(bounce);
+                color radiance = emitted_light(r, rec, scatter_pdf);
+                if (depth > 1 && connects_to_lights(rec))
+                    radiance += direct_light(r, rec, world, s);
 
-            if (world.hit(r, interval(0.001, infinity), rec)) {
                 ray scattered;
                 color attenuation;
-                if (rec.mat -> scatter(r, rec, attenuation, scattered))
-                    return attenuation * ray_color(scattered, depth - 1, world);
-                return color(0,0,0);
+                if (RT_TIMED(scatter, rec.mat -> scatter(r, rec, s, attenuation, scattered))) {
+                    throughput = throughput * attenuation;
+                    double q = roulette_survival(bounce + 1, throughput);
+                    if (q < 1) {
+                        if (s.get_1d() >= q) {
+                            RT_PATH_END(bounce + 1, false);
+                            return radiance;
+                        }
+                        attenuation /= q;
+                        throughput /= q;
+                    }
+                    double pdf = scattered_pdf(r, rec, scattered);
+                    return radiance + attenuation * ray_color(scattered, depth - 1, world, s, bounce + 1, throughput, pdf);
+                }
+                RT_PATH_END(bounce, false);
+                return radiance;
             }
+            RT_PATH_END(bounce, false);
+
+            return sky_color(r);
+        }
+
+        bool samples_lights() const {
+            return next_event_estimation && !lights.objects.empty();
+        }
+
+        // only diffuse surfaces have a brdf a sampled light direction can be weighed with
+        bool connects_to_lights(const hit_record& rec) const {
+            return samples_lights() && !rec.mat->specular();
+        }
+
+        // density the scattered ray was drawn with, which weighs the light it finds; 0 when the
+        // bounce is specular, or there is no light sampling to weigh it against
+        double scattered_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+            if (!samples_lights()) return 0;
+            return rec.mat->scattering_pdf(r_in, rec, scattered.direction());
+        }
+
+        // light emitted at rec towards the ray's origin. a ray scattered with density
+        // scatter_pdf shares the direction with light sampling, and keeps the power heuristic's
+        // share of what it finds; camera rays and specular bounces keep all of it, as light
+        // sampling can never produce their directions
+        color emitted_light(const ray& r, const hit_record& rec, double scatter_pdf) const {
+            if (!rec.mat->emits()) return color(0,0,0);
+            color emitted = rec.mat->emitted(r, rec);
+            if (scatter_pdf <= 0) return emitted;
+            double light_pdf = lights.pdf_value(r.origin(), r.direction());
+            return emitted * real(power_heuristic(scatter_pdf, light_pdf));
+        }
 
+        // next-event estimation: light reaching the diffuse hit rec straight from one point
+        // drawn on the lights, if a shadow ray finds that nothing blocks it
+        color direct_light(const ray& r_in, const hit_record& rec, const hittable& world, sampler& s) const {
+            ray shadow = rec.spawn_ray(lights.random(rec.p, s.get_2d()));
+            double light_pdf = lights.pdf_value(shadow.origin(), shadow.direction());
+            double bsdf_pdf = rec.mat->scattering_pdf(r_in, rec, shadow.direction());
+            if (light_pdf <= 0 || bsdf_pdf <= 0)
+                return color(0,0,0);
+
+            hit_record light_rec;
+            thread_path_counters().rays++;
+            if (!RT_TIMED(intersect, world.hit(shadow, interval(0, infinity), light_rec)) || !light_rec.mat->emits())
+                return color(0,0,0);
+            color f = rec.mat->eval(r_in, rec, shadow.direction());
+            return f * light_rec.mat->emitted(shadow, light_rec) * real(power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+        }
+
+        color sky_color(const ray& r) const {
+            if (!sky) return background;
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.5 * (unit_direction.y() + 1.0);
             return (1.0 - a)*color(1.0,1.0,1.0) + a*color(0.5,0.7,1.0);
         }
 
+        // probability of continuing a path after its bounce-th scatter, 1 when roulette is off
+        double roulette_survival(int bounce, const color& throughput) const {
+            if (russian_roulette_depth <= 0 || bounce < russian_roulette_depth)
+                return 1.0;
+            double max_component = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+            return std::fmin(0.95, max_component);
+        }
+
+        color trace_path(ray r, int max_depth, const hittable& world, sampler& s) const {
+            color throughput(1,1,1);
+            color radiance(0,0,0);
+            double scatter_pdf = 0;
+            auto& counters = thread_path_counters();
+            for (int bounce = 0; bounce < max_depth; bounce++) {
+                hit_record rec;
+                counters.rays++;
+                if (!RT_TIMED(intersect, world.hit(r, interval(0, infinity), rec))) {
+                    RT_PATH_END(bounce, false);
+                    return radiance + throughput * sky_color(r);
+                }
+                RT_COUNT_HIT(rec.mat->type());
+                s.start_bounce(bounce);
+                radiance += throughput * emitted_light(r, rec, scatter_pdf);
+                if (bounce + 1 < max_depth && connects_to_lights(rec))
+                    radiance += throughput * direct_light(r, rec, world, s);
+
+                ray scattered;
+                color attenuation;
+                if (!RT_TIMED(scatter, rec.mat -> scatter(r, rec, s, attenuation, scattered))) {
+                    RT_PATH_END(bounce, false);
+                    return radiance;
+                }
+
+                throughput = throughput * attenuation;
+                double q = roulette_survival(bounce + 1, throughput);
+                if (q < 1) {
+                    if (s.get_1d() >= q) {
+                        RT_PATH_END(bounce + 1, false);
+                        return radiance;
+                    }
+                    throughput /= q;
+                }
+                scatter_pdf = scattered_pdf(r, rec, scattered);
+                r = scattered;
+            }
+            RT_PATH_END(max_depth, true);
+            return radiance;
+        }
+
         void print_message(const std::string& message ) {
             std::lock_guard<std::mutex> lock (cout_mutex);
             std::cout << "Thread " << "is printing this message:" << message << '\n' << std::endl;
         }
 
-        void render_chunk(int start, int end, image_buffer& img, const hittable& world, int samples_per_pixel, int max_depth, double pixel_samples_scale) {
-            // std::cout << "This is a thread with start and end of: " << start << ' ' << end << '\n';
-            for (int j = start; j < end; j++) {
-                // print_message("working on row" + std::to_string(j));
-                for (int i = 0; i < image_width; i++) {
-                    color pixel_color(0,0,0);
-                    for (int sample = 0; sample < samples_per_pixel; sample++) {
-                        ray r = get_ray(i,j);
-                        // std::cout << ray_color(r, max_depth, world) << "\n";
-                        pixel_color += ray_color(r,max_depth, world);
+        // renders tiles from the scheduler on the calling thread until none are left, the render
+        // is interrupted or another thread's tile has thrown
+        template <typename tile_fn>
+        void drain_tiles(tile_scheduler& scheduler, thread_utilization& utilization, tile_fn& render_one,
+                         std::chrono::steady_clock::time_point render_start) {
+            tile t;
+            while (!render_interrupted && !pool->cancelled() && scheduler.next(t)) {
+                auto tile_start = std::chrono::steady_clock::now();
+                {
+                    RT_SCOPE("tile", t.x0, t.y0);
+                    render_one(t);
+                }
+                auto tile_end = std::chrono::steady_clock::now();
+                std::chrono::duration<double> elapsed = tile_end - tile_start;
+
+                auto& counters = thread_path_counters();
+                utilization.tiles++;
+                utilization.pixels += (long long)t.width() * t.height();
+                utilization.samples += counters.samples;
+                utilization.rays += counters.rays;
+                utilization.busy_seconds += elapsed.count();
+                utilization.timings.push_back(tile_timing{t, std::chrono::duration<double>(tile_start - render_start).count(), elapsed.count()});
+                counters = path_counters();
+            }
+        }
+
+        // the render threads, started on first use and restarted only when the thread count or
+        // pinning changes
+        thread_pool& workers() {
+            if (!pool || pool->size() != num_threads || pool->pinned() != pin_threads)
+                pool = std::make_unique<thread_pool>(num_threads, pin_threads);
+            return *pool;
+        }
+
+        // renders every tile of the scheduler on the render threads, stopping early once
+        // render_interrupted is set, and adds each thread's work to its utilization entry.
+        // an exception thrown while rendering a tile is rethrown here
+        template <typename tile_fn>
+        void run_tiles(tile_scheduler& scheduler, std::vector<thread_utilization>& utilization, tile_fn&& render_one,
+                       std::chrono::steady_clock::time_point render_start) {
+            workers().run([&](unsigned int i) {
+                drain_tiles(scheduler, utilization[i], render_one, render_start);
+            });
+        }
+
+        // coordinator side of distributed mode. local workers are forked before any thread or
+        // file of the render exists, so they share the scene with this process copy-on-write
+        void render_distributed(const hittable& world, int samples_per_pixel, int max_depth) {
+            int port = listen_port;
+            int listen_fd = listen_on(port, listen_port == 0);
+
+            std::vector<pid_t> children;
+            for (int k = 0; k < local_workers; k++) {
+                std::cout.flush();
+                pid_t pid = ::fork();
+                if (pid < 0) {
+                    std::cerr << "Could not start worker " << k << ": " << std::strerror(errno) << '\n';
+                    break;
+                }
+                if (pid == 0) {
+                    // only the forking thread exists in the child, so the parent's pool is
+                    // dropped without joining its threads
+                    pool.release();
+                    ::close(listen_fd);
+                    int status = 0;
+                    try {
+                        // the machine's cores are split between the local workers
+                        if (thread_count <= 0)
+                            thread_count = int(std::max(1u, std::thread::hardware_concurrency() / unsigned(local_workers)));
+                        render_worker(world, samples_per_pixel, max_depth, "127.0.0.1", port);
+                    } catch (const std::exception& e) {
+                        std::cerr << "Worker " << k << ": " << e.what() << '\n';
+                        status = 1;
+                    }
+                    std::cout.flush();
+                    std::_Exit(status);
+                }
+                children.push_back(pid);
+            }
+
+            image_buffer image(image_height, image_width, denoise);
+            std::unique_ptr<image_output> output;
+            if (!output_path.empty() && !denoise)
+                output = std::make_unique<image_output>(output_path, make_image_writer(output_path, tone), image, tile_size);
+            tile_scheduler scheduler(image_width, image_height, tile_size);
+
+            std::cout << "Coordinating " << scheduler.tile_count() << " tiles on port " << port
+                      << " with " << children.size() << " local workers\n";
+
+            auto render_start = std::chrono::steady_clock::now();
+            tile_coordinator coordinator(make_distributed_hello(image_width, image_height, seed, estimator(samples_per_pixel, max_depth), world.bounding_box()),
+                                         scheduler.all_tiles(), tile_timeout);
+
+            // with only local workers there is nobody left to finish the frame once they have all
+            // exited; a listening coordinator waits for more to join
+            size_t exited = 0;
+            auto stop = [&] {
+                while (exited < children.size() && ::waitpid(-1, nullptr, WNOHANG) > 0)
+                    exited++;
+                return render_interrupted.load()
+                    || (listen_port == 0 && exited == children.size() && coordinator.connected() == 0);
+            };
+
+            auto utilization = coordinator.run(listen_fd, [&](const tile& t, const std::vector<accum_pixel>& sums) {
+                auto dst = image.tile_accum(t);
+                for (int y = 0; y < t.height(); y++)
+                    std::copy_n(&sums[size_t(y) * t.width()], t.width(), dst.row(y).data);
+                if (output)
+                    output->tile_done(t);
+            }, stop);
+            ::close(listen_fd);
+
+            for (size_t k = exited; k < children.size(); k++)
+                ::waitpid(-1, nullptr, 0);
+
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - render_start;
+            report_utilization(utilization, wall.count());
+
+            long long rendered = 0;
+            for (const auto& u : utilization) rendered += u.tiles;
+            if (rendered < scheduler.tile_count())
+                std::cerr << "Only " << rendered << " of " << scheduler.tile_count() << " tiles were rendered\n";
+
+            // the coordinator traces the features itself, the workers only send radiance
+            if (output) {
+                output->finish();
+                std::cout << "Image written to " << output_path << '\n';
+            } else if (denoise && !output_path.empty()) {
+                write_image(output_path, denoised_image(world, image, samples_per_pixel, max_depth), tone);
+                std::cout << "Image written to " << output_path << '\n';
+            }
+
+            std::clog << "\rDone.                          \n";
+        }
+
+        // what the preview's connection thread shares with its pass loop
+        struct preview_state {
+            std::mutex m;
+            std::condition_variable changed;
+            preview_view pending;
+            uint32_t views = 0;  // views received so far
+            std::chrono::steady_clock::time_point received;
+            bool viewer_gone = false;
+            tile_scheduler* passes = nullptr; // pass in flight, cancelled by a new view
+        };
+
+        preview_view current_view() const {
+            preview_view v{};
+            for (int k = 0; k < 3; k++) {
+                v.lookfrom[k] = lookfrom[k];
+                v.lookat[k] = lookat[k];
+            }
+            v.vfov = vfov;
+            v.defocus_angle = defocus_angle;
+            v.focus_dist = focus_dist;
+            return v;
+        }
+
+        void apply_view(const preview_view& v) {
+            lookfrom = point3(v.lookfrom[0], v.lookfrom[1], v.lookfrom[2]);
+            lookat = point3(v.lookat[0], v.lookat[1], v.lookat[2]);
+            vfov = v.vfov;
+            defocus_angle = v.defocus_angle;
+            focus_dist = v.focus_dist;
+            update_view();
+        }
+
+        // runs the passes for one viewer until it disconnects or the render is interrupted. a
+        // thread reads the viewer's views; the render threads compress and send their own tiles
+        void serve_preview(int fd, const hittable& world, int samples_per_pixel, int max_depth) {
+            preview_hello hello{};
+            std::memcpy(hello.magic, preview_magic, sizeof(hello.magic));
+            hello.width = uint32_t(image_width);
+            hello.height = uint32_t(image_height);
+            hello.view = current_view();
+            if (!send_all(fd, &hello, sizeof(hello)))
+                return;
+
+            preview_state state;
+            state.pending = hello.view;
+            state.received = std::chrono::steady_clock::now();
+            std::thread reader([&] {
+                preview_view v;
+                while (recv_all(fd, &v, sizeof(v))) {
+                    std::lock_guard<std::mutex> lock(state.m);
+                    state.pending = v;
+                    state.views++;
+                    state.received = std::chrono::steady_clock::now();
+                    if (state.passes) state.passes->cancel();
+                    state.changed.notify_all();
+                }
+                std::lock_guard<std::mutex> lock(state.m);
+                state.viewer_gone = true;
+                if (state.passes) state.passes->cancel();
+                state.changed.notify_all();
+            });
+
+            image_buffer image(image_height, image_width);
+            zlib_compressor stream;
+            std::mutex send_mutex;
+            std::vector<uint8_t> pixels;
+
+            // tiles of a view that has been replaced are dropped; x0 < 0 marks the end of a pass
+            auto send = [&](const tile& t, uint32_t view, int samples, int block) {
+                std::lock_guard<std::mutex> lock(send_mutex);
+                {
+                    std::lock_guard<std::mutex> state_lock(state.m);
+                    if (state.views != view || state.viewer_gone) return;
+                }
+                // the stream's output still holds the zlib header before the first tile
+                size_t size = 0;
+                if (t.x0 >= 0) {
+                    pixels.clear();
+                    append_preview_pixels(image, t, block, tone, pixels);
+                    stream.write(pixels.data(), pixels.size());
+                    stream.flush();
+                    size = stream.output.size();
+                }
+                preview_tile_header header{t.x0, t.y0, t.x1, t.y1, view, uint32_t(samples), uint32_t(block), uint32_t(size)};
+                bool sent = send_all(fd, &header, sizeof(header)) && send_all(fd, stream.output.data(), size);
+                if (size > 0)
+                    stream.output.clear();
+                if (!sent) {
+                    std::lock_guard<std::mutex> state_lock(state.m);
+                    state.viewer_gone = true;
+                    if (state.passes) state.passes->cancel();
+                }
+            };
+
+            // the reader is stopped by shutting the socket down, also when a tile throws
+            try {
+                std::vector<thread_utilization> utilization(num_threads);
+                while (!render_interrupted) {
+                    uint32_t view;
+                    std::chrono::steady_clock::time_point received;
+                    {
+                        std::lock_guard<std::mutex> lock(state.m);
+                        if (state.viewer_gone) break;
+                        view = state.views;
+                        received = state.received;
+                        apply_view(state.pending);
                     }
-                    // std::cout << pixel_samples_scale << '\n';
-                    // if (j == 50 && i == 1) std::cout << "50 and 1 hit \n";
-                    img.set_pixel(j, i, write_color(pixel_samples_scale * pixel_color));
+                    image.clear_accum();
+                    utilization.assign(num_threads, thread_utilization());
+                    auto view_start = std::chrono::steady_clock::now();
+
+                    bool replaced = false;
+                    int reached = 0;
+                    for (int pass = 0; !render_interrupted && reached < samples_per_pixel; pass++) {
+                        int block = pass == 0 ? preview_block : 1;
+                        pass_size = pass == 0 ? 0 : std::min(std::max(1, pass_samples), 1 << std::min(pass - 1, 20));
+                        int target = pass == 0 ? 0 : std::min(samples_per_pixel, reached + pass_size);
+
+                        tile_scheduler scheduler(image_width, image_height, tile_size);
+                        {
+                            std::lock_guard<std::mutex> lock(state.m);
+                            replaced = state.views != view || state.viewer_gone;
+                            if (!replaced) state.passes = &scheduler;
+                        }
+                        if (replaced) break;
+                        if (pass == 1)
+                            image.clear_accum(); // the coarse samples were only for show
+
+                        long long samples_before = 0;
+                        for (const auto& u : utilization) samples_before += u.samples;
+                        run_tiles(scheduler, utilization, [&](const tile& t) {
+                            if (block > 1)
+                                render_tile_coarse(t, image, world, samples_per_pixel, max_depth, block);
+                            else
+                                render_tile(t, image, world, samples_per_pixel, max_depth);
+                            send(t, view, target, block);
+                        }, view_start);
+                        long long samples_after = 0;
+                        for (const auto& u : utilization) samples_after += u.samples;
+
+                        {
+                            std::lock_guard<std::mutex> lock(state.m);
+                            state.passes = nullptr;
+                            replaced = state.views != view || state.viewer_gone;
+                        }
+                        if (replaced) break;
+                        send(tile{-1, -1, -1, -1}, view, target, block);
+
+                        if (pass == 0) {
+                            std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - received;
+                            std::cout << "View " << view << ": first frame " << latency.count() << " ms after the update\n";
+                        } else {
+                            reached = target;
+                            if (samples_after == samples_before)
+                                break; // every pixel has converged
+                        }
+                    }
+                    if (replaced || render_interrupted)
+                        continue;
+
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - view_start;
+                    std::cout << "View " << view << ": " << reached << " samples per pixel in " << elapsed.count() << "s\n";
+                    std::unique_lock<std::mutex> lock(state.m);
+                    while (!render_interrupted && state.views == view && !state.viewer_gone)
+                        state.changed.wait_for(lock, std::chrono::milliseconds(200));
+                }
+            } catch (...) {
+                ::shutdown(fd, SHUT_RDWR);
+                reader.join();
+                throw;
+            }
+            ::shutdown(fd, SHUT_RDWR);
+            reader.join();
+            pass_size = 0;
+        }
+
+        // one sample at the top left pixel of every block x block square of the tile, which the
+        // preview shows across the square. the first full pass clears them and starts afresh
+        void render_tile_coarse(const tile& t, image_buffer& img, const hittable& world, int samples_per_pixel, int max_depth, int block) {
+            thread_scratch().reset();
+            sampler s = make_sampler(samples_per_pixel);
+            for (int j = t.y0; j < t.y1; j += block) {
+                for (int i = t.x0; i < t.x1; i += block) {
+                    s.start_pixel_sample(i, j, 0);
+                    ray r = get_ray(i, j, s);
+                    color c = trace_sample(r, max_depth, world, s);
+                    img.store_accum(j, i, accum_pixel{float(c.x()), float(c.y()), float(c.z()), 1, 0});
+                    thread_path_counters().samples++;
                 }
             }
         }
+
+        void render_progressive(const hittable& world, int samples_per_pixel, int max_depth) {
+            pass_size = std::max(1, pass_samples);
+            image_buffer image(image_height, image_width, denoise);
+            std::vector<thread_utilization> utilization(num_threads);
+
+            auto checkpoint = make_checkpoint_header(image, seed, estimator(samples_per_pixel, max_depth));
+            if (!checkpoint_path.empty()) {
+                if (read_checkpoint(checkpoint_path, image, checkpoint))
+                    std::cout << "Resumed from " << checkpoint_path << " at " << average_samples(image) << " samples per pixel\n";
+                else if (std::ifstream(checkpoint_path))
+                    std::cerr << checkpoint_path << " is from a render with other settings, starting afresh\n";
+            }
+
+            auto render_start = std::chrono::steady_clock::now();
+            auto last_checkpoint = render_start;
+            auto last_preview = render_start;
+            auto seconds_since = [](std::chrono::steady_clock::time_point t) {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+            };
+
+            for (int pass = 1; !render_interrupted; pass++) {
+                tile_scheduler scheduler(image_width, image_height, tile_size);
+                long long samples_before = 0;
+                for (const auto& u : utilization) samples_before += u.samples;
+
+                run_tiles(scheduler, utilization, [&](const tile& t) {
+                    render_tile(t, image, world, samples_per_pixel, max_depth);
+                }, render_start);
+
+                long long samples_after = 0;
+                for (const auto& u : utilization) samples_after += u.samples;
+                if (samples_after == samples_before)
+                    break; // every pixel has reached its sample limit or converged
+
+                std::cout << "Pass " << pass << ": " << average_samples(image) << " samples per pixel\n";
+
+                if (!checkpoint_path.empty() && seconds_since(last_checkpoint) >= checkpoint_interval) {
+                    save_checkpoint(image, checkpoint);
+                    last_checkpoint = std::chrono::steady_clock::now();
+                }
+                if (!preview_path.empty() && seconds_since(last_preview) >= preview_interval) {
+                    write_result(preview_path, world, image, samples_per_pixel, max_depth);
+                    last_preview = std::chrono::steady_clock::now();
+                }
+            }
+
+            if (render_interrupted)
+                std::cout << "Interrupted at " << average_samples(image) << " samples per pixel\n";
+
+            report_utilization(utilization, seconds_since(render_start));
+
+            if (!checkpoint_path.empty())
+                save_checkpoint(image, checkpoint);
+            if (!output_path.empty()) {
+                write_result(output_path, world, image, samples_per_pixel, max_depth);
+                std::cout << "Image written to " << output_path << '\n';
+            }
+
+            std::clog << "\rDone.                          \n";
+        }
+
+        void save_checkpoint(const image_buffer& image, const checkpoint_header& header) {
+            if (!write_checkpoint(checkpoint_path, image, header))
+                std::cerr << "Could not write checkpoint " << checkpoint_path << '\n';
+        }
+
+        // the accumulated image as it is written out: denoised, or its plain averages
+        void write_result(const std::string& path, const hittable& world, image_buffer& image, int samples_per_pixel, int max_depth) {
+            if (denoise) {
+                write_image(path, denoised_image(world, image, samples_per_pixel, max_depth), tone);
+                return;
+            }
+            write_image(path, image, tone);
+        }
+
+        // runs the feature pass over the pixels that have no aovs yet, then the denoiser, on the
+        // render threads. the accumulated sums in image are left as they are
+        image_buffer denoised_image(const hittable& world, image_buffer& image, int samples_per_pixel, int max_depth) {
+            auto start = std::chrono::steady_clock::now();
+            tile_scheduler scheduler(image_width, image_height, tile_size);
+            std::vector<thread_utilization> utilization(num_threads);
+            run_tiles(scheduler, utilization, [&](const tile& t) {
+                render_tile_aovs(t, image, world, samples_per_pixel, max_depth);
+            }, start);
+            auto features_done = std::chrono::steady_clock::now();
+
+            image_buffer result(image_height, image_width);
+            denoise_filter.run(image, result, workers());
+
+            std::chrono::duration<double> features = features_done - start;
+            std::chrono::duration<double> filter = std::chrono::steady_clock::now() - features_done;
+            std::cout << "Features traced in " << features.count() << "s, denoised in " << filter.count() << "s\n";
+            return result;
+        }
+
+        // albedo, normal and depth for the tile's pixels from their first aov_samples camera rays,
+        // the same rays their first samples started with
+        void render_tile_aovs(const tile& t, image_buffer& img, const hittable& world, int samples_per_pixel, int max_depth) {
+            thread_scratch().reset();
+            sampler s = make_sampler(samples_per_pixel);
+            int count = std::max(1, std::min(aov_samples, samples_per_pixel));
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    if (img.aov_at(j, i).weight > 0)
+                        continue;
+                    aov_pixel f;
+                    for (int sample = 0; sample < count; sample++) {
+                        s.start_pixel_sample(i, j, sample);
+                        add_aov_sample(get_ray(i, j, s), world, s, max_depth, f);
+                    }
+                    img.store_aov(j, i, f);
+                }
+            }
+        }
+
+        // adds the features camera ray r sees: the distance to its first surface, and the albedo
+        // and normal of the first surface that is not glass, following the dielectric's own
+        // choice of reflection or refraction. glass tints nothing, so what is seen through it
+        // keeps its own albedo; a ray that leaves the scene sees a white albedo and no normal
+        void add_aov_sample(const ray& r, const hittable& world, sampler& s, int max_depth, aov_pixel& f) const {
+            f.weight += 1;
+            hit_record rec;
+            if (!world.hit(r, interval(0, infinity), rec)) {
+                f.depth += aov_pixel::miss_depth;
+                for (float& a : f.albedo) a += 1;
+                return;
+            }
+            f.depth += float(rec.t * r.direction().length());
+
+            color throughput(1,1,1);
+            vec3 normal = rec.normal;
+            ray current = r;
+            for (int bounce = 0; (rec.mat->type() == material_type::dielectric || rec.mat->type() == material_type::metal) && bounce + 1 < max_depth; bounce++) {
+                s.start_bounce(bounce);
+                ray scattered;
+                color attenuation;
+                if (!rec.mat->scatter(current, rec, s, attenuation, scattered))
+                    break;
+                throughput = throughput * attenuation;
+                current = scattered;
+                if (!world.hit(current, interval(0, infinity), rec)) {
+                    add_aov_features(f, throughput, normal);
+                    return;
+                }
+                normal = rec.normal;
+            }
+            add_aov_features(f, throughput * rec.mat->albedo(), normal);
+        }
+
+        static void add_aov_features(aov_pixel& f, const color& albedo, const vec3& normal) {
+            for (int c = 0; c < 3; c++) {
+                f.albedo[c] += float(albedo[c]);
+                f.normal[c] += float(normal[c]);
+            }
+        }
+
+        static double average_samples(const image_buffer& image) {
+            double total = 0;
+            for (int j = 0; j < image.image_height; j++)
+                for (int i = 0; i < image.image_width; i++)
+                    total += image.accum_at(j, i).weight;
+            return total / (double(image.image_width) * image.image_height);
+        }
+
+        void report_utilization(const std::vector<thread_utilization>& utilization, double wall_seconds) {
+            long long image_pixels = (long long)image_width * image_height;
+            std::lock_guard<std::mutex> lock (cout_mutex);
+            std::cout << "Render time: " << wall_seconds << "s\n";
+            long long samples = 0, rays = 0;
+            for (size_t i = 0; i < utilization.size(); i++) {
+                const auto& u = utilization[i];
+                double busy = wall_seconds > 0 ? 100.0 * u.busy_seconds / wall_seconds : 0;
+                std::cout << "  thread " << i << ": " << u.tiles << " tiles, " << u.pixels << " pixels, "
+                          << u.busy_seconds << "s busy (" << busy << "%)\n";
+                samples += u.samples;
+                rays += u.rays;
+            }
+            last_stats.seconds = wall_seconds;
+            last_stats.samples = samples;
+            last_stats.rays = rays;
+            last_stats.threads = utilization;
+
+            std::cout << "Average samples per pixel: " << double(samples) / image_pixels
+                      << ", rays per sample: " << (samples > 0 ? double(rays) / samples : 0) << '\n';
+        }
+
+        // the settings this camera's sums depend on, which checkpoints and distributed workers
+        // must agree on (estimator_settings.h)
+        estimator_settings estimator(int samples_per_pixel, int max_depth) const {
+            estimator_settings e{};
+            e.sampler = uint32_t(sampling);
+            e.integrator = uint32_t(integrator);
+            e.samples_per_pixel = uint32_t(samples_per_pixel);
+            e.max_depth = uint32_t(max_depth);
+            e.adaptive_sampling = adaptive_sampling;
+            e.min_samples = uint32_t(min_samples);
+            e.adaptive_step = uint32_t(adaptive_step);
+            e.noise_threshold = float(noise_threshold);
+            e.russian_roulette_depth = uint32_t(russian_roulette_depth);
+            e.next_event_estimation = next_event_estimation;
+            return e;
+        }
+
+        // a pixel picks up from the samples already accumulated for it: none in a single-shot
+        // render, the earlier passes (or a resumed checkpoint) in progressive mode
+        pixel_estimate initial_estimate(const image_buffer& img, int i, int j) const {
+            pixel_estimate est;
+            const accum_pixel& p = img.accum_at(j, i);
+            est.sum = color(p.r, p.g, p.b);
+            est.lum_sum = 0.2126 * p.r + 0.7152 * p.g + 0.0722 * p.b;
+            est.lum_sq_sum = p.lum_sq;
+            est.count = int(p.weight);
+            return est;
+        }
+
+        void store_pixel(image_buffer& img, int i, int j, const pixel_estimate& est) {
+            img.store_accum(j, i, accum_pixel{float(est.sum.x()), float(est.sum.y()), float(est.sum.z()), float(est.count), float(est.lum_sq_sum)});
+        }
+
+        // samples a pixel is taken to in this render call: everything up to samples_per_pixel,
+        // or one more pass worth in progressive and preview mode
+        int sample_limit(const pixel_estimate& est, int samples_per_pixel) const {
+            if (pass_size <= 0)
+                return samples_per_pixel;
+            return std::min(samples_per_pixel, est.count + pass_size);
+        }
+
+        // sample count a pixel is taken to before its next convergence check
+        int next_pass_end(int count, int limit) const {
+            if (!adaptive_sampling)
+                return limit;
+            int step = count == 0 ? min_samples : adaptive_step;
+            return std::min(limit, count + std::max(1, step));
+        }
+
+        bool needs_samples(const pixel_estimate& est, int limit) const {
+            return est.count < limit && !converged(est);
+        }
+
+        bool converged(const pixel_estimate& est) const {
+            if (!adaptive_sampling || est.count < 2)
+                return false;
+            double mean = est.lum_sum / est.count;
+            double variance = std::fmax(0.0, (est.lum_sq_sum - est.lum_sum * mean) / (est.count - 1));
+            double error = 1.96 * std::sqrt(variance / est.count);
+            // the sqrt gamma curve scales an error around mean by 1 / (2 sqrt(mean))
+            return error <= noise_threshold * 2 * std::sqrt(std::fmax(mean, 1e-4));
+        }
+
+        color trace_sample(const ray& r, int max_depth, const hittable& world, sampler& s) {
+            if (integrator == integrator_type::iterative)
+                return trace_path(r, max_depth, world, s);
+            return ray_color(r, max_depth, world, s);
+        }
+
+        void render_tile(const tile& t, image_buffer& img, const hittable& world, int samples_per_pixel, int max_depth) {
+            // nothing in the thread's scratch memory outlives a tile
+            thread_scratch().reset();
+            if (integrator == integrator_type::wavefront) {
+                render_tile_wavefront(t, img, world, samples_per_pixel, max_depth);
+                return;
+            }
+
+            sampler s = make_sampler(samples_per_pixel);
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    pixel_estimate est = initial_estimate(img, i, j);
+                    int limit = sample_limit(est, samples_per_pixel);
+                    if (!needs_samples(est, limit))
+                        continue;
+
+                    int first = est.count;
+                    while (needs_samples(est, limit)) {
+                        int pass_end = next_pass_end(est.count, limit);
+                        for (int sample = est.count; sample < pass_end; sample++) {
+                            s.start_pixel_sample(i, j, sample);
+                            ray r = get_ray(i, j, s);
+                            est.add(trace_sample(r, max_depth, world, s));
+                        }
+                    }
+                    thread_path_counters().samples += est.count - first;
+                    store_pixel(img, i, j, est);
+                }
+            }
+        }
+
+        // samples [first, first + count) of one tile pixel, queued for a wavefront pass
+        struct pixel_work {
+            int pixel;
+            int first;
+            int count;
+        };
+
+        // a wavefront pass over one tile: the samples queued per pixel and, once traced, one
+        // radiance value per path. everything lives in the thread's scratch arena
+        struct wavefront_pass {
+            pixel_work* work;
+            int work_count;
+            color* radiance;
+        };
+
+        // renders the tile in passes with the same sample schedule as render_tile: each pass queues
+        // the next samples of every unconverged pixel and traces them all as one wavefront
+        void render_tile_wavefront(const tile& t, image_buffer& img, const hittable& world, int samples_per_pixel, int max_depth) {
+            arena& scratch = thread_scratch();
+
+            int tile_pixels = t.width() * t.height();
+            auto* estimates = scratch.make_array<pixel_estimate>(tile_pixels);
+            int* limits = scratch.make_array<int>(tile_pixels);
+            wavefront_pass pass{scratch.make_array<pixel_work>(tile_pixels), 0, nullptr};
+            for (int pixel = 0; pixel < tile_pixels; pixel++) {
+                auto& est = estimates[pixel];
+                est = initial_estimate(img, t.x0 + pixel % t.width(), t.y0 + pixel / t.width());
+                limits[pixel] = sample_limit(est, samples_per_pixel);
+                if (needs_samples(est, limits[pixel]))
+                    pass.work[pass.work_count++] = pixel_work{pixel, est.count, next_pass_end(est.count, limits[pixel]) - est.count};
+            }
+            long long new_samples = 0;
+            for (int pixel = 0; pixel < tile_pixels; pixel++)
+                new_samples -= estimates[pixel].count;
+
+            sampler tile_sampler = make_sampler(samples_per_pixel);
+            while (pass.work_count > 0) {
+                // the pass's paths and queues are dropped as soon as its radiance is summed
+                auto pass_start = scratch.mark();
+                trace_wavefront(t, pass, world, max_depth, tile_sampler);
+
+                // paths are numbered pixel-major, so each pixel sums its samples in sample order
+                // exactly like the per-pixel integrators do
+                size_t path = 0;
+                int pending = 0;
+                for (int n = 0; n < pass.work_count; n++) {
+                    const pixel_work w = pass.work[n];
+                    auto& est = estimates[w.pixel];
+                    for (int s = 0; s < w.count; s++)
+                        est.add(pass.radiance[path++]);
+                    int limit = limits[w.pixel];
+                    if (needs_samples(est, limit))
+                        pass.work[pending++] = pixel_work{w.pixel, est.count, next_pass_end(est.count, limit) - est.count};
+                }
+                pass.work_count = pending;
+                scratch.rewind(pass_start);
+            }
+
+            for (int pixel = 0; pixel < tile_pixels; pixel++) {
+                int i = t.x0 + pixel % t.width();
+                int j = t.y0 + pixel / t.width();
+                new_samples += estimates[pixel].count;
+                store_pixel(img, i, j, estimates[pixel]);
+            }
+            thread_path_counters().samples += new_samples;
+        }
+
+        // traces every sample queued in pass.work, wavefront_batch paths at a time, and leaves
+        // one radiance value per path in pass.radiance
+        void trace_wavefront(const tile& t, wavefront_pass& pass, const hittable& world, int max_depth, const sampler& tile_sampler) {
+            constexpr int material_types = int(material_type::diffuse_light) + 1;
+            constexpr int primary_packet = 8;
+
+            long long total_paths = 0;
+            for (int n = 0; n < pass.work_count; n++)
+                total_paths += pass.work[n].count;
+
+            // ray batches and hit queues for the largest batch, reused by every batch of the pass
+            arena& scratch = thread_scratch();
+            int capacity = int(std::min<long long>(wavefront_batch, total_paths));
+            pass.radiance = scratch.make_array<color>(size_t(total_paths));
+            auto* paths = scratch.make_array<path_state>(capacity);
+            ray* rays = scratch.make_array<ray>(capacity);
+            hit_record* recs = scratch.make_array<hit_record>(capacity);
+            bool* hit_flags = scratch.make_array<bool>(capacity);
+            int* active = scratch.make_array<int>(capacity);
+            int* next_active = scratch.make_array<int>(capacity);
+            int* shade_order = scratch.make_array<int>(capacity);
+
+            int work_index = 0;
+            int work_sample = 0;
+            auto& counters = thread_path_counters();
+
+            for (long long batch_start = 0; batch_start < total_paths; batch_start += wavefront_batch) {
+                int batch = int(std::min<long long>(wavefront_batch, total_paths - batch_start));
+                int live = 0;
+
+                // generate: camera rays for every path in the batch
+                for (int k = 0; k < batch; k++) {
+                    while (work_sample == pass.work[work_index].count) {
+                        work_index++;
+                        work_sample = 0;
+                    }
+                    const auto& w = pass.work[work_index];
+                    int i = t.x0 + w.pixel % t.width();
+                    int j = t.y0 + w.pixel / t.width();
+
+                    auto& p = paths[k];
+                    p.samples = tile_sampler;
+                    p.samples.start_pixel_sample(i, j, w.first + work_sample);
+                    work_sample++;
+                    p.r = get_ray(i, j, p.samples);
+                    p.throughput = color(1,1,1);
+                    p.radiance = color(0,0,0);
+                    p.scatter_pdf = 0;
+                    p.random = thread_rng();
+                    active[live++] = k;
+                }
+
+                for (int depth = 0; depth < max_depth && live > 0; depth++) {
+                    counters.rays += live;
+
+                    // extend: intersect every live path. camera rays of neighbouring samples are
+                    // coherent enough to share packet traversal, bounced rays are traced one by one
+                    for (int n = 0; n < live; n++)
+                        rays[n] = paths[active[n]].r;
+                    if (depth == 0) {
+                        for (int n = 0; n < live; n += primary_packet) {
+                            int count = std::min(primary_packet, live - n);
+                            RT_TIMED(intersect, world.hit_packet(&rays[n], count, interval(0, infinity), &recs[n], hit_flags + n));
+                        }
+                    } else {
+                        for (int n = 0; n < live; n++)
+                            hit_flags[n] = RT_TIMED(intersect, world.hit(rays[n], interval(0, infinity), recs[n]));
+                    }
+
+                    // connect: misses pick up the sky and end; hits are queued by material type
+                    int type_counts[material_types + 1] = {};
+                    for (int n = 0; n < live; n++) {
+                        if (hit_flags[n]) {
+                            RT_COUNT_HIT(recs[n].mat->type());
+                            type_counts[int(recs[n].mat->type()) + 1]++;
+                        } else {
+                            auto& p = paths[active[n]];
+                            p.radiance += p.throughput * sky_color(p.r);
+                            RT_PATH_END(depth, false);
+                        }
+                    }
+                    for (int m = 0; m < material_types; m++)
+                        type_counts[m + 1] += type_counts[m];
+                    int shaded = type_counts[material_types];
+                    for (int n = 0; n < live; n++) {
+                        if (hit_flags[n])
+                            shade_order[type_counts[int(recs[n].mat->type())]++] = n;
+                    }
+
+                    // shade: add emission and sampled direct light, scatter each queued hit, then
+                    // play russian roulette on the survivors. hit_flags is reused to mark the paths
+                    // that carry on
+                    for (int order = 0; order < shaded; order++) {
+                        int n = shade_order[order];
+                        auto& p = paths[active[n]];
+                        const hit_record& rec = recs[n];
+                        ray scattered;
+                        color attenuation;
+
+                        std::swap(thread_rng(), p.random);
+                        p.samples.start_bounce(depth);
+                        p.radiance += p.throughput * emitted_light(p.r, rec, p.scatter_pdf);
+                        if (depth + 1 < max_depth && connects_to_lights(rec))
+                            p.radiance += p.throughput * direct_light(p.r, rec, world, p.samples);
+
+                        bool alive = RT_TIMED(scatter, rec.mat -> scatter(p.r, rec, p.samples, attenuation, scattered));
+                        if (alive) {
+                            p.throughput = p.throughput * attenuation;
+                            p.scatter_pdf = scattered_pdf(p.r, rec, scattered);
+                            p.r = scattered;
+                            double q = roulette_survival(depth + 1, p.throughput);
+                            if (q < 1) {
+                                alive = p.samples.get_1d() < q;
+                                p.throughput /= q;
+                            }
+                            if (!alive) RT_PATH_END(depth + 1, false);
+                        } else {
+                            RT_PATH_END(depth, false);
+                        }
+                        std::swap(thread_rng(), p.random);
+
+                        hit_flags[n] = alive;
+                    }
+
+                    // compact in path order, so neighbouring samples stay together
+                    int survivors = 0;
+                    for (int n = 0; n < live; n++) {
+                        if (hit_flags[n])
+                            next_active[survivors++] = active[n];
+                    }
+                    std::swap(active, next_active);
+                    live = survivors;
+                }
+
+                // paths still alive after max_depth bounces contribute nothing
+                for (int n = 0; n < live; n++)
+                    RT_PATH_END(max_depth, true);
+                for (int k = 0; k < batch; k++)
+                    pass.radiance[batch_start + k] = paths[k].radiance;
+            }
+        }
 };
 
 #endif
\ No newline at end of file
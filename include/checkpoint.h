@@ -0,0 +1,87 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "estimator_settings.h"
+#include "image_buffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// binary snapshot of a progressive render: a fixed header followed by the accumulation
+// buffer, one accum_pixel per pixel in row-major order without the row padding.
+// the seed and the estimator settings are stored so a resumed job draws the same sample
+// streams the original would have and weighs them the same way; the stratified sampler's
+// strata depend on the sample target, and adaptive sampling, russian roulette or another
+// integrator would add samples of a different estimator to the saved sums
+struct checkpoint_header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint64_t seed;
+    uint32_t pixel_size;
+    uint32_t color_size;
+    estimator_settings estimator;
+};
+
+static_assert(sizeof(checkpoint_header) == 72, "the header is compared byte for byte and must have no padding");
+
+constexpr char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '3'};
+
+// the header a render with these settings writes and expects to resume from
+inline checkpoint_header make_checkpoint_header(const image_buffer& image, uint64_t seed, const estimator_settings& estimator) {
+    checkpoint_header header{};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.width = uint32_t(image.image_width);
+    header.height = uint32_t(image.image_height);
+    header.seed = seed;
+    header.pixel_size = uint32_t(sizeof(accum_pixel));
+    header.color_size = uint32_t(sizeof(color));
+    header.estimator = estimator;
+    return header;
+}
+
+// writes next to the target and renames over it, so a crash mid-write never loses the previous checkpoint
+inline bool write_checkpoint(const std::string& path, const image_buffer& image, const checkpoint_header& header) {
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<accum_pixel> row(image.image_width);
+        for (int j = 0; j < image.image_height; j++) {
+            for (int i = 0; i < image.image_width; i++)
+                row[i] = image.accum_at(j, i);
+            out.write(reinterpret_cast<const char*>(row.data()), std::streamsize(row.size() * sizeof(accum_pixel)));
+        }
+        if (!out) return false;
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+// restores the accumulation buffer, returns false when the file is missing or belongs to another
+// render: one of another size, seed, precision or estimator settings than expected describes
+inline bool read_checkpoint(const std::string& path, image_buffer& image, const checkpoint_header& expected) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    checkpoint_header header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(&header, &expected, sizeof(header)) != 0)
+        return false;
+
+    std::vector<accum_pixel> pixels(size_t(image.image_width) * image.image_height);
+    in.read(reinterpret_cast<char*>(pixels.data()), std::streamsize(pixels.size() * sizeof(accum_pixel)));
+    if (!in) return false;
+
+    for (int j = 0; j < image.image_height; j++)
+        for (int i = 0; i < image.image_width; i++)
+            image.store_accum(j, i, pixels[size_t(j) * image.image_width + i]);
+    return true;
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+inline uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// streaming zlib (RFC 1950/1951) compressor: greedy LZ77 over a 32K window with hash chains,
+// coded with the fixed Huffman tables. every write() emits one block that may refer back into
+// data from earlier writes, so rows can be compressed as they arrive without holding the image
+class zlib_compressor {
+    public:
+        // compressed bytes are appended here; callers may drain it between writes
+        std::vector<uint8_t> output;
+
+        zlib_compressor() : head(hash_size, -1) {
+            output.push_back(0x78); // deflate, 32K window
+            output.push_back(0x01); // fastest compression level, no preset dictionary
+        }
+
+        void write(const uint8_t* data, size_t size) {
+            if (size == 0) return;
+            update_adler(data, size);
+
+            // keep the last window's worth of history in front of the new data
+            size_t base = window.size();
+            window.insert(window.end(), data, data + size);
+            prev.resize(window.size(), -1);
+
+            put_bits(0, 1); // not final
+            put_bits(1, 2); // fixed Huffman codes
+
+            size_t pos = base;
+            size_t end = window.size();
+            while (pos < end) {
+                int best_len = 0;
+                int best_dist = 0;
+                if (pos + min_match <= end) {
+                    find_match(pos, end, best_len, best_dist);
+                }
+
+                if (best_len >= min_match) {
+                    put_length(best_len);
+                    put_distance(best_dist);
+                    for (int k = 0; k < best_len; k++)
+                        insert_hash(pos + k, end);
+                    pos += best_len;
+                } else {
+                    put_literal(window[pos]);
+                    insert_hash(pos, end);
+                    pos++;
+                }
+            }
+            put_symbol(256); // end of block
+
+            slide_window();
+        }
+
+        // ends the current block on a byte boundary with an empty stored block (a zlib sync
+        // flush), so everything written so far can be decoded from the output drained up to here
+        void flush() {
+            put_bits(0, 1); // not final
+            put_bits(0, 2); // stored
+            if (bit_count > 0) {
+                output.push_back(uint8_t(bit_buffer));
+                bit_buffer = 0;
+                bit_count = 0;
+            }
+            const uint8_t empty[4] = {0x00, 0x00, 0xff, 0xff};
+            output.insert(output.end(), empty, empty + 4);
+        }
+
+        void finish() {
+            put_bits(1, 1); // final, empty fixed block
+            put_bits(1, 2);
+            put_symbol(256);
+            if (bit_count > 0) {
+                output.push_back(uint8_t(bit_buffer));
+                bit_buffer = 0;
+                bit_count = 0;
+            }
+            uint32_t adler = (adler_b << 16) | adler_a;
+            output.push_back(uint8_t(adler >> 24));
+            output.push_back(uint8_t(adler >> 16));
+            output.push_back(uint8_t(adler >> 8));
+            output.push_back(uint8_t(adler));
+        }
+
+    private:
+        static constexpr int window_size = 32768;
+        static constexpr int hash_size = 1 << 15;
+        static constexpr int min_match = 3;
+        static constexpr int max_match = 258;
+        static constexpr int max_chain = 32;
+
+        std::vector<uint8_t> window;
+        std::vector<int> head; // most recent window position per hash
+        std::vector<int> prev; // previous position with the same hash
+        uint32_t bit_buffer = 0;
+        int bit_count = 0;
+        uint32_t adler_a = 1, adler_b = 0;
+
+        static uint32_t hash3(const uint8_t* p) {
+            return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 2654435761u) >> 17;
+        }
+
+        void insert_hash(size_t pos, size_t end) {
+            if (pos + min_match > end) return;
+            uint32_t h = hash3(&window[pos]);
+            prev[pos] = head[h];
+            head[h] = int(pos);
+        }
+
+        void find_match(size_t pos, size_t end, int& best_len, int& best_dist) {
+            int limit = int(std::min<size_t>(max_match, end - pos));
+            int candidate = head[hash3(&window[pos])];
+            for (int chain = 0; candidate >= 0 && chain < max_chain; chain++) {
+                int dist = int(pos) - candidate;
+                if (dist > window_size) break;
+
+                const uint8_t* a = &window[candidate];
+                const uint8_t* b = &window[pos];
+                int len = 0;
+                while (len < limit && a[len] == b[len])
+                    len++;
+
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = dist;
+                    if (len == limit) break;
+                }
+                candidate = prev[candidate];
+            }
+        }
+
+        // drops history older than the window so memory stays bounded for long streams
+        void slide_window() {
+            if (window.size() <= size_t(2 * window_size)) return;
+            int shift = int(window.size()) - window_size;
+            window.erase(window.begin(), window.begin() + shift);
+            prev.erase(prev.begin(), prev.begin() + shift);
+            for (auto& p : prev) p = p >= shift ? p - shift : -1;
+            for (auto& h : head) h = h >= shift ? h - shift : -1;
+        }
+
+        void update_adler(const uint8_t* data, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                adler_a = (adler_a + data[i]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+        }
+
+        void put_bits(uint32_t value, int count) {
+            bit_buffer |= value << bit_count;
+            bit_count += count;
+            while (bit_count >= 8) {
+                output.push_back(uint8_t(bit_buffer));
+                bit_buffer >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        // Huffman codes are stored most significant bit first
+        void put_code(uint32_t code, int length) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++)
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            put_bits(reversed, length);
+        }
+
+        void put_symbol(int symbol) {
+            if (symbol < 144)      put_code(0x30 + symbol, 8);
+            else if (symbol < 256) put_code(0x190 + symbol - 144, 9);
+            else if (symbol < 280) put_code(symbol - 256, 7);
+            else                   put_code(0xc0 + symbol - 280, 8);
+        }
+
+        void put_literal(uint8_t value) { put_symbol(value); }
+
+        void put_length(int length) {
+            static const int base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+            static const int extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+            int code = 28;
+            while (base[code] > length) code--;
+            put_symbol(257 + code);
+            put_bits(length - base[code], extra[code]);
+        }
+
+        void put_distance(int distance) {
+            static const int base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+                                         1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+            static const int extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+            int code = 29;
+            while (base[code] > distance) code--;
+            put_code(code, 5);
+            put_bits(distance - base[code], extra[code]);
+        }
+};
+
+// streaming counterpart of zlib_compressor for a stream that is sync-flushed between writes:
+// every call to write() takes the bytes drained after one flush and appends what they decode to.
+// stored and fixed Huffman blocks are understood, which is all zlib_compressor emits
+class zlib_decompressor {
+    public:
+        void write(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+            in = data;
+            in_size = size;
+            in_pos = 0;
+            bit_buffer = 0;
+            bit_count = 0;
+
+            if (!header_read) {
+                if (size < 2 || (data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0)
+                    throw std::runtime_error("not a zlib stream");
+                in_pos = 2;
+                header_read = true;
+            }
+
+            size_t first = out.size();
+            while (in_pos < in_size || bit_count >= 3) {
+                get_bits(1); // final flag, the stream is never closed
+                int type = int(get_bits(2));
+                if (type == 0) {
+                    bit_buffer = 0;
+                    bit_count = 0;
+                    uint32_t len = get_byte();
+                    len |= get_byte() << 8;
+                    uint32_t nlen = get_byte();
+                    nlen |= get_byte() << 8;
+                    if ((len ^ 0xffff) != nlen)
+                        throw std::runtime_error("corrupt stored block");
+                    for (uint32_t k = 0; k < len; k++)
+                        out.push_back(uint8_t(get_byte()));
+                } else if (type == 1) {
+                    inflate_fixed(out, first);
+                } else {
+                    throw std::runtime_error("unsupported deflate block type");
+                }
+            }
+
+            // the last window of output stays as history for matches in later writes
+            history.insert(history.end(), out.begin() + std::ptrdiff_t(first), out.end());
+            if (history.size() > size_t(2 * window_size))
+                history.erase(history.begin(), history.end() - window_size);
+        }
+
+    private:
+        static constexpr int window_size = 32768;
+
+        std::vector<uint8_t> history;
+        bool header_read = false;
+        const uint8_t* in = nullptr;
+        size_t in_size = 0;
+        size_t in_pos = 0;
+        uint32_t bit_buffer = 0;
+        int bit_count = 0;
+
+        uint32_t get_byte() {
+            if (in_pos >= in_size)
+                throw std::runtime_error("truncated deflate stream");
+            return in[in_pos++];
+        }
+
+        uint32_t get_bits(int count) {
+            while (bit_count < count) {
+                bit_buffer |= get_byte() << bit_count;
+                bit_count += 8;
+            }
+            uint32_t value = bit_buffer & ((1u << count) - 1);
+            bit_buffer >>= count;
+            bit_count -= count;
+            return value;
+        }
+
+        // Huffman codes arrive most significant bit first
+        uint32_t get_code(int length) {
+            uint32_t code = 0;
+            for (int i = 0; i < length; i++)
+                code = (code << 1) | get_bits(1);
+            return code;
+        }
+
+        int get_symbol() {
+            uint32_t code = get_code(7);
+            if (code <= 0x17) return int(code) + 256;
+            code = (code << 1) | get_bits(1);
+            if (code >= 0x30 && code <= 0xbf) return int(code) - 0x30;
+            if (code >= 0xc0 && code <= 0xc7) return int(code) - 0xc0 + 280;
+            code = (code << 1) | get_bits(1);
+            return int(code) - 0x190 + 144;
+        }
+
+        void inflate_fixed(std::vector<uint8_t>& out, size_t first) {
+            static const int length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+            static const int length_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+            static const int distance_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+                                                  1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+            static const int distance_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+            while (true) {
+                int symbol = get_symbol();
+                if (symbol < 256) {
+                    out.push_back(uint8_t(symbol));
+                    continue;
+                }
+                if (symbol == 256) return;
+                if (symbol > 285)
+                    throw std::runtime_error("corrupt deflate length");
+
+                int length = length_base[symbol - 257] + int(get_bits(length_extra[symbol - 257]));
+                int code = int(get_code(5));
+                if (code >= 30)
+                    throw std::runtime_error("corrupt deflate distance");
+                size_t distance = size_t(distance_base[code]) + get_bits(distance_extra[code]);
+
+                // a match may reach back past this write's output into the history
+                size_t produced = out.size() - first;
+                if (distance > produced + history.size())
+                    throw std::runtime_error("deflate distance beyond the window");
+                for (int k = 0; k < length; k++) {
+                    produced = out.size() - first;
+                    uint8_t value = distance <= produced ? out[out.size() - distance]
+                                                         : history[history.size() - (distance - produced)];
+                    out.push_back(value);
+                }
+            }
+        }
+};
+
+#endif
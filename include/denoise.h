@@ -0,0 +1,291 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "image_buffer.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "instrument.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// exp(x) for x <= 0 to a few parts in a million, in plain float arithmetic so the filter loops
+// that call it vectorize: x = (n + f) ln 2 with n the nearest integer, 2^f from its Taylor
+// polynomial and 2^n put straight into the exponent bits. n is rounded by adding 1.5 * 2^23,
+// which leaves it in the low mantissa bits; a float to int conversion would stop the vectorizer
+inline float exp_negative(float x) {
+    constexpr float round_bias = 12582912.0f;
+    float t = std::max(x, -87.0f) * 1.44269504f;
+    float shifted = t + round_bias;
+    float f = t - (shifted - round_bias);
+    float p = 1.0f + f * (0.6931472f + f * (0.2402265f + f * (0.05550411f + f * (0.009618129f + f * 0.001333356f))));
+    int32_t bits;
+    std::memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits - 0x4B400000 + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// edge-avoiding a-trous wavelet filter, the spatial part of SVGF (Schied et al. 2017) guided by
+// the image's aov buffers. radiance is divided by albedo first, so textures and material colours
+// are not blurred, only the lighting; each iteration then takes a 5x5 B3-spline footprint whose
+// taps are 2^iteration pixels apart and weighs every tap by how alike the two pixels are:
+//   normal    - cosine between the normals to the power normal_power, taken as
+//               exp(-normal_power (1 - cosine)) so every term shares one exponential
+//   depth     - distance difference over sigma_depth times the local depth gradient
+//   luminance - squared difference less the part the two pixels' noise explains, over
+//               sigma_luminance^2 times their summed variance, as in the nl-means distance of
+//               Rousselle et al. 2012. the variance of each pixel's mean comes from its
+//               accumulated luminance moments; a single pixel's estimate is too noisy to trust
+//               at low sample counts, so as in SVGF it is blurred with a 3x3 gaussian before the
+//               first iteration, and then filtered along with the image
+//   albedo    - sum of the channel differences over sigma_albedo
+// the image is kept as planes of floats so the inner loop runs over a row at a time and
+// vectorizes; rows are shared out between the threads of the pool
+class denoiser {
+    public:
+        int iterations = 5;
+        float normal_power = 32;
+        float sigma_luminance = 2;
+        float sigma_depth = 1;
+        float sigma_albedo = 0.1f;
+
+        // filters the accumulated radiance of in into the sums of out, a buffer of the same size,
+        // as one sample per pixel. in needs aovs
+        void run(const image_buffer& in, image_buffer& out, thread_pool& threads) {
+            RT_SCOPE("denoise");
+            width = in.image_width;
+            height = in.image_height;
+            stride = aligned_stride<float>(width);
+            for (auto& p : planes)
+                p.assign(std::size_t(stride) * height, 0.0f);
+
+            for_rows(threads, [&](int y) { load_row(in, y); });
+            for_rows(threads, [&](int y) { depth_gradient_row(y); });
+            // the blurred variance takes the place of the raw one the first iteration reads
+            for_rows(threads, [&](int y) { prefilter_variance_row(y); });
+            std::swap(planes[variance], planes[variance2]);
+
+            int current = 0;
+            for (int k = 0; k < iterations; k++) {
+                int step = 1 << k;
+                for_rows(threads, [&](int y) { filter_row(current, step, y); });
+                current ^= 1;
+            }
+
+            for_rows(threads, [&](int y) { store_row(current, out, y); });
+        }
+
+    private:
+        // illumination and its variance twice over, read from one and written to the other
+        enum plane_index { red, green, blue, variance, red2, green2, blue2, variance2, albedo_r, albedo_g, albedo_b, normal_x, normal_y, normal_z,
+                           depth, depth_gradient, plane_count };
+
+        static constexpr float epsilon = 1e-4f;
+        static constexpr float min_albedo = 1e-3f;
+        static constexpr int rows_per_claim = 4;
+
+        int width = 0, height = 0, stride = 0;
+        std::vector<float, aligned_allocator<float>> planes[plane_count];
+
+        float* row_of(int plane, int y) { return planes[plane].data() + std::size_t(y) * stride; }
+
+        static float luminance(float r, float g, float b) { return 0.2126f * r + 0.7152f * g + 0.0722f * b; }
+
+        // runs fn for every row, rows_per_claim rows at a time to whichever thread is free
+        template <typename row_fn>
+        void for_rows(thread_pool& threads, row_fn&& fn) {
+            std::atomic<int> next{0};
+            threads.run([&](unsigned int) {
+                for (int y0; (y0 = next.fetch_add(rows_per_claim)) < height;)
+                    for (int y = y0; y < std::min(y0 + rows_per_claim, height); y++)
+                        fn(y);
+            });
+        }
+
+        // mean radiance divided by albedo, the variance of that mean, and the guide features
+        void load_row(const image_buffer& in, int y) {
+            float *r = row_of(red, y), *g = row_of(green, y), *b = row_of(blue, y), *v = row_of(variance, y);
+            float *ar = row_of(albedo_r, y), *ag = row_of(albedo_g, y), *ab = row_of(albedo_b, y);
+            float *nx = row_of(normal_x, y), *ny = row_of(normal_y, y), *nz = row_of(normal_z, y);
+            float* z = row_of(depth, y);
+            for (int x = 0; x < width; x++) {
+                const accum_pixel& p = in.accum_at(y, x);
+                const aov_pixel& f = in.aov_at(y, x);
+                float inv_f = f.weight > 0 ? 1 / f.weight : 0;
+                ar[x] = f.weight > 0 ? f.albedo[0] * inv_f : 1;
+                ag[x] = f.weight > 0 ? f.albedo[1] * inv_f : 1;
+                ab[x] = f.weight > 0 ? f.albedo[2] * inv_f : 1;
+                z[x] = f.depth * inv_f;
+                float len = std::sqrt(f.normal[0] * f.normal[0] + f.normal[1] * f.normal[1] + f.normal[2] * f.normal[2]);
+                float inv_len = len > 0 ? 1 / len : 0;
+                nx[x] = f.normal[0] * inv_len;
+                ny[x] = f.normal[1] * inv_len;
+                nz[x] = f.normal[2] * inv_len;
+
+                float n = p.weight;
+                if (n <= 0) {
+                    r[x] = g[x] = b[x] = v[x] = 0;
+                    continue;
+                }
+                r[x] = p.r / n / std::max(ar[x], min_albedo);
+                g[x] = p.g / n / std::max(ag[x], min_albedo);
+                b[x] = p.b / n / std::max(ab[x], min_albedo);
+
+                // sample variance of the luminance over n, the variance of the pixel's mean, in
+                // the units of the demodulated image
+                float lum = luminance(p.r, p.g, p.b) / n;
+                float sample_variance = n > 1 ? std::max(0.0f, p.lum_sq / n - lum * lum) * n / (n - 1) : lum * lum;
+                float albedo_lum = std::max(luminance(ar[x], ag[x], ab[x]), min_albedo);
+                v[x] = sample_variance / n / (albedo_lum * albedo_lum);
+            }
+        }
+
+        // how fast depth changes around each pixel: of the two one-sided differences along each
+        // axis the smaller, so a silhouette does not make the surfaces on either side look steep
+        void depth_gradient_row(int y) {
+            const float* z = row_of(depth, y);
+            const float* up = y > 0 ? row_of(depth, y - 1) : nullptr;
+            const float* down = y + 1 < height ? row_of(depth, y + 1) : nullptr;
+            float* dz = row_of(depth_gradient, y);
+            auto smaller = [](float a, float b) { return std::min(a, b) < HUGE_VALF ? std::min(a, b) : 0.0f; };
+            for (int x = 0; x < width; x++) {
+                float left = x > 0 ? std::fabs(z[x] - z[x - 1]) : HUGE_VALF;
+                float right = x + 1 < width ? std::fabs(z[x + 1] - z[x]) : HUGE_VALF;
+                float above = up ? std::fabs(z[x] - up[x]) : HUGE_VALF;
+                float below = down ? std::fabs(down[x] - z[x]) : HUGE_VALF;
+                dz[x] = std::max(smaller(left, right), smaller(above, below));
+            }
+        }
+
+        // the variance blurred with the 3x3 gaussian (1 2 1) x (1 2 1) / 16 into the second
+        // variance plane, which the first iteration does not read yet; taps outside the image
+        // are left out and the weights that remain renormalized
+        void prefilter_variance_row(int y) {
+            static const float kernel[3] = {0.25f, 0.5f, 0.25f};
+            float* out = row_of(variance2, y);
+            for (int x = 0; x < width; x++) {
+                float sum = 0, weight = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    int qy = y + dy;
+                    if (qy < 0 || qy >= height) continue;
+                    const float* v = row_of(variance, qy);
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int qx = x + dx;
+                        if (qx < 0 || qx >= width) continue;
+                        float w = kernel[dx + 1] * kernel[dy + 1];
+                        sum += w * v[qx];
+                        weight += w;
+                    }
+                }
+                out[x] = sum / weight;
+            }
+        }
+
+        // one a-trous iteration for row y, from the current planes into the other pair
+        void filter_row(int current, int step, int y) {
+            static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+            int in_r = current ? red2 : red, in_g = in_r + 1, in_b = in_r + 2, in_v = in_r + 3;
+            int out_r = current ? red : red2;
+
+            const float *pr = row_of(in_r, y), *pg = row_of(in_g, y), *pb = row_of(in_b, y), *pv = row_of(in_v, y);
+            const float *pnx = row_of(normal_x, y), *pny = row_of(normal_y, y), *pnz = row_of(normal_z, y);
+            const float *par = row_of(albedo_r, y), *pag = row_of(albedo_g, y), *pab = row_of(albedo_b, y);
+            const float *pz = row_of(depth, y), *pdz = row_of(depth_gradient, y);
+
+            // per-pixel terms of the centre and the running sums, in the thread's scratch memory
+            arena& scratch = thread_scratch();
+            auto scratch_start = scratch.mark();
+            float* lum = scratch.make_array<float>(width, cache_line_size);
+            float* sum_w = scratch.make_array<float>(width, cache_line_size);
+            float* sum_r = scratch.make_array<float>(width, cache_line_size);
+            float* sum_g = scratch.make_array<float>(width, cache_line_size);
+            float* sum_b = scratch.make_array<float>(width, cache_line_size);
+            float* sum_v = scratch.make_array<float>(width, cache_line_size);
+
+            // the centre tap always counts fully, whatever its features
+            float centre = kernel[2] * kernel[2];
+            for (int x = 0; x < width; x++) {
+                lum[x] = luminance(pr[x], pg[x], pb[x]);
+                sum_w[x] = centre;
+                sum_r[x] = centre * pr[x];
+                sum_g[x] = centre * pg[x];
+                sum_b[x] = centre * pb[x];
+                sum_v[x] = centre * centre * pv[x];
+            }
+
+            float inv_sigma_albedo = 1 / sigma_albedo;
+            for (int dy = -2; dy <= 2; dy++) {
+                int qy = y + dy * step;
+                if (qy < 0 || qy >= height) continue;
+                for (int dx = -2; dx <= 2; dx++) {
+                    if (dx == 0 && dy == 0) continue;
+                    int offset = dx * step;
+                    int x0 = std::max(0, -offset), x1 = std::min(width, width - offset);
+                    if (x0 >= x1) continue;
+
+                    const float *qr = row_of(in_r, qy) + offset, *qg = row_of(in_g, qy) + offset;
+                    const float *qb = row_of(in_b, qy) + offset, *qv = row_of(in_v, qy) + offset;
+                    const float *qnx = row_of(normal_x, qy) + offset, *qny = row_of(normal_y, qy) + offset;
+                    const float *qnz = row_of(normal_z, qy) + offset;
+                    const float *qar = row_of(albedo_r, qy) + offset, *qag = row_of(albedo_g, qy) + offset;
+                    const float *qab = row_of(albedo_b, qy) + offset;
+                    const float* qz = row_of(depth, qy) + offset;
+                    float h = kernel[dx + 2] * kernel[dy + 2];
+                    float depth_scale = sigma_depth * float(step * (std::abs(dx) + std::abs(dy)));
+
+                    // the sums are scratch arrays apart from every plane, which gcc cannot prove
+                    // for this many streams; the hint lets the loop vectorize
+#pragma GCC ivdep
+                    for (int x = x0; x < x1; x++) {
+                        float e_normal = normal_power * (1 - (pnx[x] * qnx[x] + pny[x] * qny[x] + pnz[x] * qnz[x]));
+                        float e_depth = std::fabs(pz[x] - qz[x]) / (depth_scale * pdz[x] + epsilon);
+                        float d_lum = lum[x] - luminance(qr[x], qg[x], qb[x]);
+                        float vq = qv[x];
+                        float e_lum = std::max(0.0f, d_lum * d_lum - (pv[x] + std::min(pv[x], vq)))
+                                      / (sigma_luminance * sigma_luminance * (pv[x] + vq) + epsilon * epsilon);
+                        float e_albedo = (std::fabs(par[x] - qar[x]) + std::fabs(pag[x] - qag[x]) + std::fabs(pab[x] - qab[x]))
+                                         * inv_sigma_albedo;
+                        float w = h * exp_negative(-(e_normal + e_depth + e_lum + e_albedo));
+
+                        sum_w[x] += w;
+                        sum_r[x] += w * qr[x];
+                        sum_g[x] += w * qg[x];
+                        sum_b[x] += w * qb[x];
+                        sum_v[x] += w * w * qv[x];
+                    }
+                }
+            }
+
+            float *r = row_of(out_r, y), *g = row_of(out_r + 1, y), *b = row_of(out_r + 2, y), *v = row_of(out_r + 3, y);
+            for (int x = 0; x < width; x++) {
+                float inv = 1 / sum_w[x];
+                r[x] = sum_r[x] * inv;
+                g[x] = sum_g[x] * inv;
+                b[x] = sum_b[x] * inv;
+                v[x] = sum_v[x] * inv * inv;
+            }
+            scratch.rewind(scratch_start);
+        }
+
+        // filtered illumination times albedo, as one sample's worth of sums
+        void store_row(int current, image_buffer& out, int y) {
+            int in_r = current ? red2 : red;
+            const float *r = row_of(in_r, y), *g = row_of(in_r + 1, y), *b = row_of(in_r + 2, y);
+            const float *ar = row_of(albedo_r, y), *ag = row_of(albedo_g, y), *ab = row_of(albedo_b, y);
+            for (int x = 0; x < width; x++) {
+                float cr = r[x] * std::max(ar[x], min_albedo);
+                float cg = g[x] * std::max(ag[x], min_albedo);
+                float cb = b[x] * std::max(ab[x], min_albedo);
+                float lum = luminance(cr, cg, cb);
+                out.store_accum(y, x, accum_pixel{cr, cg, cb, 1, lum * lum});
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "aabb.h"
+#include "estimator_settings.h"
+#include "image_buffer.h"
+#include "tile_scheduler.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// wire format between a render coordinator and its workers. every worker thread holds one tcp
+// connection to the coordinator and the exchange on it is strictly request and reply:
+//   worker      -> distributed_hello, refused when it describes a different render
+//   coordinator -> tile_job, a tile to render, or one with x0 < 0 once no tiles are left
+//   worker      -> tile_result_header, then the tile's accum_pixels row by row
+// values go out in host byte order, so every machine of a farm must share it; the sizes of a
+// color and a pixel are part of the hello, which keeps float and double builds from being mixed.
+// a pixel's samples are drawn from the render seed, the sampler and the pixel alone
+// (sampler::start_pixel_sample), so a tile comes back the same whichever worker rendered it
+// and however often it was retried. the scene itself is not sent; its bounding box stands in
+// for it, which catches a worker started on another scene file but not one edited in place
+struct distributed_hello {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint64_t seed;
+    uint32_t color_size;
+    uint32_t pixel_size;
+    estimator_settings estimator;
+    float scene_bounds[6]; // world bounding box: min and max along x, y and z
+};
+
+static_assert(sizeof(distributed_hello) == 96, "the hello is compared byte for byte and must have no padding");
+
+constexpr char distributed_magic[8] = {'R', 'T', 'D', 'I', 'S', 'T', '0', '3'};
+
+struct tile_job {
+    int32_t x0, y0, x1, y1;
+};
+
+struct tile_result_header {
+    tile_job job;
+    int64_t samples;
+    int64_t rays;
+    double busy_seconds;
+};
+
+inline distributed_hello make_distributed_hello(int width, int height, uint64_t seed, const estimator_settings& estimator,
+                                                const aabb& scene_bounds) {
+    distributed_hello hello{};
+    std::memcpy(hello.magic, distributed_magic, sizeof(hello.magic));
+    hello.width = uint32_t(width);
+    hello.height = uint32_t(height);
+    hello.seed = seed;
+    hello.color_size = uint32_t(sizeof(color));
+    hello.pixel_size = uint32_t(sizeof(accum_pixel));
+    hello.estimator = estimator;
+    for (int axis = 0; axis < 3; axis++) {
+        hello.scene_bounds[2 * axis] = float(scene_bounds.axis_interval(axis).min);
+        hello.scene_bounds[2 * axis + 1] = float(scene_bounds.axis_interval(axis).max);
+    }
+    return hello;
+}
+
+inline std::runtime_error socket_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// writes all of data, returns false once the peer is gone
+inline bool send_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+// reads exactly size bytes, returns false on a closed connection, an error or a receive timeout
+inline bool recv_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+// sends the accumulation sums of t row by row; display values are made by the coordinator
+inline bool send_tile_pixels(int fd, image_buffer& image, const tile& t) {
+    auto sums = image.tile_accum(t);
+    for (int y = 0; y < t.height(); y++)
+        if (!send_all(fd, sums.row(y).data, sizeof(accum_pixel) * size_t(t.width()))) return false;
+    return true;
+}
+
+// listening socket on port, or on a free port chosen by the system when port is 0, which is
+// then stored back into port. with loopback_only only this machine can connect
+inline int listen_on(int& port, bool loopback_only) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) throw socket_error("socket");
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+    addr.sin_port = htons(uint16_t(port));
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 64) < 0) {
+        auto error = socket_error("cannot listen on port " + std::to_string(port));
+        ::close(fd);
+        throw error;
+    }
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// connects to host:port, retrying for up to retry_seconds while the coordinator starts up
+inline int connect_to(const std::string& host, int port, double retry_seconds) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    int status = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found);
+    if (status != 0)
+        throw std::runtime_error("cannot resolve " + host + ": " + ::gai_strerror(status));
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(retry_seconds);
+    while (true) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            ::freeaddrinfo(found);
+            throw socket_error("socket");
+        }
+        if (::connect(fd, found->ai_addr, found->ai_addrlen) == 0) {
+            ::freeaddrinfo(found);
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            return fd;
+        }
+        auto error = socket_error("cannot connect to " + host + ":" + std::to_string(port));
+        ::close(fd);
+        if (std::chrono::steady_clock::now() >= deadline) {
+            ::freeaddrinfo(found);
+            throw error;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+// tiles a worker process is rendering or has rendered, shared by all its connections. the
+// coordinator gives a tile to another connection when the first is too slow, and that one can
+// belong to the same process; it then waits for the render already under way and sends its sums
+// instead of rendering the same pixels alongside it
+class worker_tile_claims {
+    public:
+        // true when the caller is to render t, false when t's sums in the process's buffer are
+        // already complete
+        bool claim(const tile& t) {
+            std::unique_lock<std::mutex> lock(m);
+            changed.wait(lock, [&] { return in_flight.count(key(t)) == 0; });
+            if (rendered.count(key(t)))
+                return false;
+            in_flight.insert(key(t));
+            return true;
+        }
+
+        // ends a claim; complete says whether t's sums are now all there
+        void release(const tile& t, bool complete) {
+            std::lock_guard<std::mutex> lock(m);
+            in_flight.erase(key(t));
+            if (complete)
+                rendered.insert(key(t));
+            changed.notify_all();
+        }
+
+    private:
+        using tile_key = std::tuple<int, int, int, int>;
+
+        std::mutex m;
+        std::condition_variable changed;
+        std::set<tile_key> in_flight;
+        std::set<tile_key> rendered;
+
+        static tile_key key(const tile& t) { return tile_key(t.x0, t.y0, t.x1, t.y1); }
+};
+
+// hands the tiles of one frame to the workers that connect to a listening socket and collects
+// what they send back. each connection is served by its own thread. a tile goes back to the
+// front of the queue when its worker's connection drops or stays silent for tile_timeout
+// seconds, and that connection is closed, so every tile is delivered exactly once
+class tile_coordinator {
+    public:
+        // called with a finished tile and the sums its pixels were received into
+        using result_fn = std::function<void(const tile&, const std::vector<accum_pixel>&)>;
+
+        tile_coordinator(const distributed_hello& expected, const std::vector<tile>& tiles, double tile_timeout)
+            : expected(expected), pending(tiles.begin(), tiles.end()), total(int(tiles.size())), tile_timeout(tile_timeout) {}
+
+        // serves workers until every tile is in. stop is polled a few times a second: once it
+        // returns true no more tiles are handed out, and the call returns when those in flight
+        // are back. the returned entries describe one worker connection each
+        std::vector<thread_utilization> run(int listen_fd, const result_fn& on_result, const std::function<bool()>& stop) {
+            std::vector<std::thread> handlers;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    if (completed == total) break;
+                    if (stopping && in_flight == 0) break;
+                }
+                if (!stopping && stop()) {
+                    std::lock_guard<std::mutex> lock(m);
+                    stopping = true;
+                    changed.notify_all();
+                }
+
+                pollfd p{listen_fd, POLLIN, 0};
+                if (::poll(&p, 1, 200) <= 0 || !(p.revents & POLLIN))
+                    continue;
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) continue;
+
+                std::lock_guard<std::mutex> lock(m);
+                connections++;
+                workers.emplace_back();
+                thread_utilization* stats = &workers.back();
+                handlers.emplace_back([this, fd, stats, &on_result] { serve(fd, *stats, on_result); });
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+                changed.notify_all();
+            }
+            for (auto& h : handlers) h.join();
+            return std::vector<thread_utilization>(workers.begin(), workers.end());
+        }
+
+        // workers currently connected
+        int connected() const {
+            std::lock_guard<std::mutex> lock(m);
+            return connections;
+        }
+
+    private:
+        distributed_hello expected;
+        mutable std::mutex m;
+        std::condition_variable changed;
+        std::deque<tile> pending;
+        std::deque<thread_utilization> workers; // stable addresses, one per connection
+        int total;
+        int in_flight = 0;
+        int completed = 0;
+        int connections = 0;
+        bool stopping = false;
+        double tile_timeout;
+
+        // next tile for a worker; waits while tiles are only in flight, since one of them may
+        // yet come back. returns false when the worker should be sent away
+        bool take(tile& t) {
+            std::unique_lock<std::mutex> lock(m);
+            changed.wait(lock, [&] { return stopping || completed == total || !pending.empty(); });
+            if (stopping || pending.empty()) return false;
+            t = pending.front();
+            pending.pop_front();
+            in_flight++;
+            return true;
+        }
+
+        void serve(int fd, thread_utilization& stats, const result_fn& on_result) {
+            timeval timeout{};
+            timeout.tv_sec = long(tile_timeout);
+            timeout.tv_usec = long((tile_timeout - double(timeout.tv_sec)) * 1e6);
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            distributed_hello hello{};
+            bool accepted = recv_all(fd, &hello, sizeof(hello));
+            if (accepted && std::memcmp(&hello, &expected, sizeof(hello)) != 0) {
+                std::cerr << "Refused a worker with another image size, seed, precision, scene bounding box or sampling settings "
+                             "(sampler, integrator, samples, depth, adaptive sampling, russian roulette or light sampling)\n";
+                accepted = false;
+            }
+
+            std::vector<accum_pixel> sums;
+            tile t;
+            while (accepted && take(t)) {
+                tile_job job{t.x0, t.y0, t.x1, t.y1};
+                tile_result_header header{};
+                size_t pixels = size_t(t.width()) * t.height();
+                sums.resize(pixels);
+
+                bool received = send_all(fd, &job, sizeof(job))
+                    && recv_all(fd, &header, sizeof(header))
+                    && std::memcmp(&header.job, &job, sizeof(job)) == 0
+                    && recv_all(fd, sums.data(), sizeof(accum_pixel) * pixels);
+
+                if (!received) {
+                    std::cerr << "Lost a worker, tile at (" << t.x0 << ", " << t.y0 << ") goes to another\n";
+                    std::lock_guard<std::mutex> lock(m);
+                    pending.push_front(t);
+                    in_flight--;
+                    changed.notify_all();
+                    accepted = false;
+                    break;
+                }
+
+                on_result(t, sums);
+                std::lock_guard<std::mutex> lock(m);
+                stats.tiles++;
+                stats.pixels += (long long)pixels;
+                stats.samples += header.samples;
+                stats.rays += header.rays;
+                stats.busy_seconds += header.busy_seconds;
+                in_flight--;
+                completed++;
+                changed.notify_all();
+            }
+
+            if (accepted) {
+                tile_job done{-1, -1, -1, -1};
+                send_all(fd, &done, sizeof(done));
+            }
+            ::close(fd);
+            std::lock_guard<std::mutex> lock(m);
+            connections--;
+        }
+};
+
+#endif
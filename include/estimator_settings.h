@@ -0,0 +1,23 @@
+#ifndef ESTIMATOR_SETTINGS_H
+#define ESTIMATOR_SETTINGS_H
+
+#include <cstdint>
+
+// the render settings that decide which samples a pixel gets and how each one is traced and
+// weighed. sums accumulated under different settings estimate the image differently and are
+// not to be added up, so checkpoints and distributed workers carry these and refuse a mismatch.
+// all fields are 4 bytes wide, leaving no padding in the headers that are compared byte for byte
+struct estimator_settings {
+    uint32_t sampler;    // sampler_type
+    uint32_t integrator; // integrator_type
+    uint32_t samples_per_pixel;
+    uint32_t max_depth;
+    uint32_t adaptive_sampling;
+    uint32_t min_samples;
+    uint32_t adaptive_step;
+    float noise_threshold;
+    uint32_t russian_roulette_depth;
+    uint32_t next_event_estimation;
+};
+
+#endif
@@ -2,6 +2,8 @@
 #define HITTABLE_H
 
 #include "constants.h"
+#include "aabb.h"
+#include "sampler.h"
 
 class material;
 
@@ -9,10 +11,16 @@ class hit_record {
     public:
         point3 p;
         vec3 normal;
-        shared_ptr<material> mat; 
-        double t;  
+        const material* mat = nullptr; // owned by the scene's material_table
+        real t;  
+        real error = 0; // bound on the rounding error in each coordinate of p
         bool front_face;
 
+        // ray scattered from p in the given direction, starting clear of the surface
+        ray spawn_ray(const vec3& direction) const {
+            return ray(offset_ray_origin(p, error, normal, direction), direction);
+        }
+
         void set_face_normal(const ray& r, const vec3& outward_normal) {
             front_face = dot(r.direction(), outward_normal) < 0;
             normal = front_face ? outward_normal : -outward_normal;
@@ -22,7 +30,24 @@ class hit_record {
 class hittable {
     public: 
         virtual ~hittable() = default;
+        // rec is only written when the ray hits, so callers can pass the same record to several objects
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+        virtual aabb bounding_box() const = 0;
+
+        // intersects a batch of rays, hits[k] tells whether recs[k] was filled.
+        // primitives that can share work across coherent rays override this
+        virtual void hit_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const {
+            for (int k = 0; k < count; k++)
+                hits[k] = hit(rays[k], ray_t, recs[k]);
+        }
+
+        // light sampling: the solid-angle density with which random(origin, u) picks direction,
+        // and the direction from origin towards the object that the uniform pair u maps to.
+        // only shapes that can be used as lights override these
+        virtual double pdf_value(const point3& /*origin*/, const vec3& /*direction*/) const { return 0.0; }
+
+        virtual vec3 random(const point3& /*origin*/, const sample2& /*u*/) const { return vec3(1,0,0); }
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "hittable.h"
 
 #include "constants.h"
+#include <algorithm>
 #include <vector>
 
 class hittable_list : public hittable {
@@ -13,26 +14,48 @@ class hittable_list : public hittable {
         hittable_list() {}
         hittable_list(shared_ptr<hittable> object) { add(object); }
 
-        void clear() {objects.clear(); }
+        void clear() {objects.clear(); bbox = aabb(); }
 
         void add(shared_ptr<hittable> object) {
             objects.push_back(object);
+            bbox = aabb(bbox, object->bounding_box());
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            hit_record temp_rec;
             bool hit_anything = false;
             auto closest_so_far = ray_t.max;
 
+            // each hit narrows the interval, so a later object only overwrites rec when it is closer
             for (const auto& object : objects) {
-                if (object -> hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+                if (object -> hit(r, interval(ray_t.min, closest_so_far), rec)) {
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec;
+                    closest_so_far = rec.t;
                 }
             }
             
             return hit_anything;
         }
+
+        aabb bounding_box() const override { return bbox; }
+
+        // as a set of lights: random picks an object uniformly, so the density of a direction
+        // is the average of the objects' densities. the pick uses the leading digits of u.u
+        // and the object gets the rest, still uniform
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            if (objects.empty()) return 0.0;
+            double sum = 0.0;
+            for (const auto& object : objects)
+                sum += object->pdf_value(origin, direction);
+            return sum / double(objects.size());
+        }
+
+        vec3 random(const point3& origin, const sample2& u) const override {
+            double scaled = u.u * double(objects.size());
+            size_t k = std::min(objects.size() - 1, size_t(scaled));
+            return objects[k]->random(origin, sample2{std::fmin(scaled - double(k), 0x1.fffffffffffffp-1), u.v});
+        }
+
+    private:
+        aabb bbox;
 };
 #endif
\ No newline at end of file
@@ -1,79 +1,164 @@
 #ifndef IMAGE_BUFFER_H
 #define IMAGE_BUFFER_H
 
-#include <mutex> 
 #include "vec3.h"
 #include "color.h"
+#include "aligned_allocator.h"
+#include "tile_scheduler.h"
+#include <algorithm>
 #include <vector>
-#include <fstream> 
 #include <stdexcept>
 #include <sstream>  // For std::ostringstream
 
-// represents points on a ray using the function P(t) = origin + tb, where P(t) is the point in a ray , t is a scalar representing position on the ray and b is the direction vector
-// direction vector is dir = target - origin
+// contiguous view of count pixels, e.g. one row of a tile
+template <typename T>
+struct pixel_span {
+    T* data;
+    int count;
+
+    T* begin() const { return data; }
+    T* end() const { return data + count; }
+    T& operator[](int i) const { return data[i]; }
+};
+
+// rectangular window into a framebuffer; consecutive rows are stride pixels apart
+template <typename T>
+struct tile_span {
+    T* data;
+    int width;
+    int height;
+    int stride;
+
+    pixel_span<T> row(int y) const { return pixel_span<T>{data + std::ptrdiff_t(y) * stride, width}; }
+};
+
+// running sums of linear radiance for one pixel. weight counts the samples taken so far and
+// lum_sq sums their squared luminance, so the pixel's variance survives between passes
+struct accum_pixel {
+    float r = 0, g = 0, b = 0;
+    float weight = 0;
+    float lum_sq = 0;
+};
+
+// sums of the auxiliary features of one pixel's first visible surface, as the denoiser sees
+// them: albedo (through glass, of the first diffuse surface behind it), world-space shading
+// normal and distance from the camera. weight counts the camera rays they were taken from
+struct aov_pixel {
+    static constexpr float miss_depth = 1e6f; // depth of a ray that leaves the scene
+
+    float albedo[3] = {0, 0, 0};
+    float normal[3] = {0, 0, 0};
+    float depth = 0;
+    float weight = 0;
+};
+
+// padded row length so that every row starts on a cache line, keeping threads that own
+// disjoint tiles off each other's lines wherever tile edges fall on a multiple of it
+template <typename T>
+inline int aligned_stride(int width) {
+    int per_line = 1;
+    while ((per_line * sizeof(T)) % cache_line_size != 0)
+        per_line++;
+    return (width + per_line - 1) / per_line * per_line;
+}
+
+// framebuffer shared by the render threads. every pixel is owned by exactly one tile and so
+// by one thread, which lets store_accum write without locking. pixels are running sums of
+// linear radiance; display values are only made from them as the image is written (tone_map.h).
+// pixels live in one cache-line-aligned allocation, row-major with a padded stride
 class image_buffer {
-    public: 
-        int image_height; 
+    public:
+        int image_height;
         int image_width;
 
-        std::vector<std::vector<color>>buffer;
-        std::mutex buffer_mutex;
-
-        image_buffer(int height, int width) {
+        image_buffer(int height, int width, bool aovs = false) {
             image_height = height;
             image_width = width;
             std::cout << "created image with height: " << height << " and width " << width << '\n';
-            // Resize the buffer to match the given dimensions
-            buffer.resize(image_height, std::vector<color>(image_width));
-
-            // Initialize the buffer with black pixels (0.0, 0.0, 0.0)
-            for (int i = 0; i < image_height; ++i) {
-                for (int j = 0; j < image_width; ++j) {
-                    buffer[i][j] = color(0.0, 0.0, 0.0); // Initialize each pixel to black
-                }
+
+            // value-initialized, so every pixel starts black with no samples
+            accum_stride = aligned_stride<accum_pixel>(image_width);
+            accum.assign(std::size_t(accum_stride) * image_height, accum_pixel());
+            if (aovs) {
+                aov_stride = aligned_stride<aov_pixel>(image_width);
+                aov.assign(std::size_t(aov_stride) * image_height, aov_pixel());
             }
         }
 
-        void set_pixel(int i, int j, const color& c) {
-            if (i < 0 || i >= image_height || j < 0 || j >= image_width) {
-                std::ostringstream oss;
-                oss << "pixel coordinates out of range: (" << i << ", " << j << ") "
-                    << "Image dimensions: (" << image_width << " x " << image_height << ")";
-                throw std::out_of_range(oss.str());
-            }
-            // std::cout << "Setting pixel (" << i << ", " << j << ") to color: " 
-            //         << c.e[0] << " " << c.e[1] << " " << c.e[2] << std::endl;
-            std::lock_guard<std::mutex> lock(buffer_mutex);
-            buffer[i][j] = c;
+        const accum_pixel& accum_at(int i, int j) const {
+            check_bounds(i, j);
+            return accum[index(i, j)];
         }
 
-        void write_to_ppm() {
-            std::ofstream out("image.ppm");
+        // replaces a pixel's accumulated sums
+        void store_accum(int i, int j, const accum_pixel& p) {
+            check_bounds(i, j);
+            accum[index(i, j)] = p;
+        }
+
+        // zeroes the accumulated sums, so the buffer can take a new frame
+        void clear_accum() {
+            std::fill(accum.begin(), accum.end(), accum_pixel());
+        }
+
+        // zeroes the sums of one tile's pixels only
+        void clear_accum(const tile& t) {
+            auto sums = tile_accum(t);
+            for (int y = 0; y < t.height(); y++)
+                std::fill_n(sums.row(y).data, t.width(), accum_pixel());
+        }
 
-            // Write PPM header
-            out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        // mean of the accumulated samples, black until the first sample arrives
+        color average(int i, int j) const {
+            const accum_pixel& p = accum_at(i, j);
+            if (p.weight <= 0) return color(0, 0, 0);
+            return color(p.r / p.weight, p.g / p.weight, p.b / p.weight);
+        }
 
-            // Loop through the buffer and write pixel data
-            for (int j = 0; j < image_height; j++) {
-                for (int i = 0; i < image_width; i++) {
+        pixel_span<const accum_pixel> accum_row(int i) const {
+            return pixel_span<const accum_pixel>{&accum[index(i, 0)], image_width};
+        }
 
-                    color& pixel = buffer[j][i];
+        bool has_aovs() const { return !aov.empty(); }
 
-                    
-                    int r = pixel.e[0]; 
-                    int g = pixel.e[1];
-                    int b = pixel.e[2];
+        const aov_pixel& aov_at(int i, int j) const {
+            check_bounds(i, j);
+            return aov[std::size_t(i) * aov_stride + j];
+        }
 
-                    out << r << ' ' << g << ' ' << b << '\n';
-                }
-            }
+        void store_aov(int i, int j, const aov_pixel& p) {
+            check_bounds(i, j);
+            aov[std::size_t(i) * aov_stride + j] = p;
+        }
 
-            // Close the file
-            out.close();
-            std::cout << "Image written to image.ppm\n";
+        tile_span<accum_pixel> tile_accum(const tile& t) {
+            return tile_span<accum_pixel>{&accum[index(t.y0, t.x0)], t.width(), t.height(), accum_stride};
         }
 
+    private:
+        int accum_stride = 0;
+        int aov_stride = 0;
+        std::vector<accum_pixel, aligned_allocator<accum_pixel>> accum;
+        std::vector<aov_pixel, aligned_allocator<aov_pixel>> aov;
 
+        std::size_t index(int i, int j) const {
+            return std::size_t(i) * accum_stride + j;
+        }
+
+        // bounds are only checked in debug builds, the render loop never leaves its tile
+        void check_bounds(int i, int j) const {
+#ifndef NDEBUG
+            if (i < 0 || i >= image_height || j < 0 || j >= image_width) {
+                std::ostringstream oss;
+                oss << "pixel coordinates out of range: (" << i << ", " << j << ") "
+                    << "Image dimensions: (" << image_width << " x " << image_height << ")";
+                throw std::out_of_range(oss.str());
+            }
+#else
+            (void)i;
+            (void)j;
+#endif
+        }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,322 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+#include "image_buffer.h"
+#include "tone_map.h"
+#include "deflate.h"
+#include "instrument.h"
+
+#include <cctype>
+#include <cstdio>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// output stage for one image format. rows are handed over in order from the top of the image,
+// each as soon as every tile covering it has been rendered
+class image_writer {
+    public:
+        // how the 8-bit formats map radiance to display values; linear formats ignore it
+        tone_mapping tone;
+
+        virtual ~image_writer() = default;
+
+        virtual void begin(std::ostream& out, int width, int height) = 0;
+        virtual void write_row(std::ostream& out, const image_buffer& image, int j) = 0;
+        virtual void finish(std::ostream& out) { (void)out; }
+};
+
+// binary P6 PPM, one byte per channel
+class ppm_writer : public image_writer {
+    public:
+        void begin(std::ostream& out, int width, int height) override {
+            out << "P6\n" << width << ' ' << height << "\n255\n";
+            bytes.resize(3 * size_t(width));
+        }
+
+        void write_row(std::ostream& out, const image_buffer& image, int j) override {
+            RT_TIMED(tone_map, tone.apply(image.accum_row(j), bytes.data()));
+            out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        }
+
+    private:
+        std::vector<uint8_t> bytes;
+};
+
+// 8-bit RGB PNG. every row gets the filter with the smallest absolute residual sum and is
+// deflated into its own IDAT chunk straight away
+class png_writer : public image_writer {
+    public:
+        void begin(std::ostream& out, int width, int height) override {
+            static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            out.write(reinterpret_cast<const char*>(signature), 8);
+
+            uint8_t header[13];
+            put_u32(header, uint32_t(width));
+            put_u32(header + 4, uint32_t(height));
+            header[8] = 8;   // bit depth
+            header[9] = 2;   // truecolor
+            header[10] = 0;  // deflate
+            header[11] = 0;  // adaptive filtering
+            header[12] = 0;  // no interlace
+            write_chunk(out, "IHDR", header, sizeof(header));
+
+            row_bytes = 3 * size_t(width);
+            current.assign(row_bytes, 0);
+            previous.assign(row_bytes, 0);
+            filtered.assign(row_bytes + 1, 0);
+            best.assign(row_bytes + 1, 0);
+            compressor = zlib_compressor();
+        }
+
+        void write_row(std::ostream& out, const image_buffer& image, int j) override {
+            RT_TIMED(tone_map, tone.apply(image.accum_row(j), current.data()));
+
+            long best_score = -1;
+            for (uint8_t filter = 0; filter < 5; filter++) {
+                long score = apply_filter(filter);
+                if (best_score < 0 || score < best_score) {
+                    best_score = score;
+                    best.swap(filtered);
+                }
+            }
+
+            compressor.write(best.data(), best.size());
+            flush_compressed(out);
+            previous.swap(current);
+        }
+
+        void finish(std::ostream& out) override {
+            compressor.finish();
+            flush_compressed(out);
+            write_chunk(out, "IEND", nullptr, 0);
+        }
+
+    private:
+        size_t row_bytes = 0;
+        std::vector<uint8_t> current, previous, filtered, best;
+        zlib_compressor compressor;
+
+        static void put_u32(uint8_t* p, uint32_t v) {
+            p[0] = uint8_t(v >> 24);
+            p[1] = uint8_t(v >> 16);
+            p[2] = uint8_t(v >> 8);
+            p[3] = uint8_t(v);
+        }
+
+        static void write_chunk(std::ostream& out, const char* type, const uint8_t* data, size_t size) {
+            uint8_t length[4];
+            put_u32(length, uint32_t(size));
+            out.write(reinterpret_cast<const char*>(length), 4);
+
+            uint32_t crc = crc32_update(0, reinterpret_cast<const uint8_t*>(type), 4);
+            out.write(type, 4);
+            if (size > 0) {
+                crc = crc32_update(crc, data, size);
+                out.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+            }
+
+            uint8_t crc_bytes[4];
+            put_u32(crc_bytes, crc);
+            out.write(reinterpret_cast<const char*>(crc_bytes), 4);
+        }
+
+        void flush_compressed(std::ostream& out) {
+            if (compressor.output.empty()) return;
+            write_chunk(out, "IDAT", compressor.output.data(), compressor.output.size());
+            compressor.output.clear();
+        }
+
+        static uint8_t paeth(int a, int b, int c) {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc) return uint8_t(a);
+            if (pb <= pc) return uint8_t(b);
+            return uint8_t(c);
+        }
+
+        // fills `filtered` with the filter type byte and residuals, returns the residual magnitude
+        long apply_filter(uint8_t filter) {
+            filtered[0] = filter;
+            long score = 0;
+            for (size_t x = 0; x < row_bytes; x++) {
+                int a = x >= 3 ? current[x - 3] : 0;
+                int b = previous[x];
+                int c = x >= 3 ? previous[x - 3] : 0;
+                int predicted = 0;
+                switch (filter) {
+                    case 1: predicted = a; break;
+                    case 2: predicted = b; break;
+                    case 3: predicted = (a + b) / 2; break;
+                    case 4: predicted = paeth(a, b, c); break;
+                }
+                uint8_t residual = uint8_t(current[x] - predicted);
+                filtered[x + 1] = residual;
+                score += residual < 128 ? residual : 256 - residual;
+            }
+            return score;
+        }
+};
+
+// portable float map: the averaged linear radiance as floats, before any exposure or curve,
+// stored bottom row first. rows still arrive top down, so each one is written straight to its
+// final offset in the file
+class pfm_writer : public image_writer {
+    public:
+        void begin(std::ostream& out, int width, int height) override {
+            uint16_t probe = 1;
+            bool little_endian = *reinterpret_cast<uint8_t*>(&probe) == 1;
+            out << "PF\n" << width << ' ' << height << '\n' << (little_endian ? "-1.0" : "1.0") << '\n';
+            data_start = out.tellp();
+            image_height = height;
+            values.resize(3 * size_t(width));
+        }
+
+        void write_row(std::ostream& out, const image_buffer& image, int j) override {
+            float* p = values.data();
+            for (int i = 0; i < image.image_width; i++) {
+                color c = image.average(j, i);
+                *p++ = float(c.x());
+                *p++ = float(c.y());
+                *p++ = float(c.z());
+            }
+            auto row_size = std::streamoff(values.size() * sizeof(float));
+            out.seekp(data_start + std::streamoff(image_height - 1 - j) * row_size);
+            out.write(reinterpret_cast<const char*>(values.data()), row_size);
+        }
+
+    private:
+        std::streampos data_start;
+        int image_height = 0;
+        std::vector<float> values;
+};
+
+// picks the encoder from the file extension
+inline std::unique_ptr<image_writer> make_image_writer(const std::string& path, const tone_mapping& tone = tone_mapping()) {
+    auto dot = path.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+    for (auto& ch : ext) ch = char(std::tolower(static_cast<unsigned char>(ch)));
+
+    std::unique_ptr<image_writer> writer;
+    if (ext == "ppm") writer = std::make_unique<ppm_writer>();
+    else if (ext == "png") writer = std::make_unique<png_writer>();
+    else if (ext == "pfm") writer = std::make_unique<pfm_writer>();
+    else throw std::invalid_argument("unsupported image format: " + path + " (expected .ppm, .png or .pfm)");
+    writer->tone = tone;
+    return writer;
+}
+
+// writes a finished image in one go. the file is written under a temporary name and renamed
+// into place, so viewers polling a preview path never see a half-written file
+inline void write_image(const std::string& path, const image_buffer& image, const tone_mapping& tone = tone_mapping()) {
+    auto writer = make_image_writer(path, tone);
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("cannot open " + temp_path + " for writing");
+        writer->begin(out, image.image_width, image.image_height);
+        for (int j = 0; j < image.image_height; j++)
+            writer->write_row(out, image, j);
+        writer->finish(out);
+        if (!out)
+            throw std::runtime_error("write failed: " + temp_path);
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("cannot move " + temp_path + " to " + path);
+}
+
+// streams a render to disk while it is still in progress. render threads report finished tiles;
+// a background thread encodes each band of tile rows once all of its tiles are in, so encoding
+// overlaps with rendering and only the last band is left when the render ends
+class image_output {
+    public:
+        image_output(const std::string& path, std::unique_ptr<image_writer> writer, const image_buffer& image, int tile_size)
+            : path(path), writer(std::move(writer)), image(image), tile_size(std::max(1, tile_size)) {
+            out.open(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                throw std::runtime_error("cannot open " + path + " for writing");
+
+            int tiles_per_band = (image.image_width + this->tile_size - 1) / this->tile_size;
+            int bands = (image.image_height + this->tile_size - 1) / this->tile_size;
+            remaining.assign(bands, tiles_per_band);
+
+            encoder = std::thread([this] { encode(); });
+        }
+
+        ~image_output() {
+            if (encoder.joinable()) {
+                try {
+                    finish();
+                } catch (const std::exception& e) {
+                    std::cerr << "Error writing " << path << ": " << e.what() << '\n';
+                }
+            }
+        }
+
+        // called by a render thread after it has written every pixel of t
+        void tile_done(const tile& t) {
+            std::lock_guard<std::mutex> lock(band_mutex);
+            if (--remaining[t.y0 / tile_size] == 0)
+                band_ready.notify_one();
+        }
+
+        // encodes whatever is left, including bands that never completed, and closes the file
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(band_mutex);
+                finishing = true;
+            }
+            band_ready.notify_one();
+            encoder.join();
+            out.close();
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+    private:
+        std::string path;
+        std::unique_ptr<image_writer> writer;
+        const image_buffer& image;
+        int tile_size;
+        std::ofstream out;
+
+        std::mutex band_mutex;
+        std::condition_variable band_ready;
+        std::vector<int> remaining; // unfinished tiles per band of tile_size rows
+        bool finishing = false;
+        std::thread encoder;
+        std::exception_ptr error;
+
+        void encode() {
+            try {
+                writer->begin(out, image.image_width, image.image_height);
+                for (size_t band = 0; band < remaining.size(); band++) {
+                    {
+                        std::unique_lock<std::mutex> lock(band_mutex);
+                        band_ready.wait(lock, [&] { return remaining[band] <= 0 || finishing; });
+                    }
+                    int first_row = int(band) * tile_size;
+                    int last_row = std::min(first_row + tile_size, image.image_height);
+                    RT_SCOPE("encode band", 0, first_row);
+                    for (int j = first_row; j < last_row; j++)
+                        writer->write_row(out, image, j);
+                }
+                writer->finish(out);
+                if (!out)
+                    throw std::runtime_error("write failed");
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "bvh.h"
+#include "transform.h"
+
+#include <unordered_set>
+#include <vector>
+
+// intersects a prototype placed in the world by the inverse of world_to_object. the ray is
+// carried into object space without renormalizing its direction, so the prototype's t is the
+// world t, and rec is left in object space for object_hit_to_world
+inline bool hit_object(const hittable& prototype, const transform& world_to_object,
+                       const ray& r, interval ray_t, hit_record& rec) {
+    ray object_ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()));
+    return prototype.hit(object_ray, ray_t, rec);
+}
+
+// carries the point and normal of an object-space hit back to world space. the point is mapped
+// rather than recomputed from t, so the prototype's refinement of it survives along with its
+// error bound, which is widened a little more for the rounding in the inverted matrix. the sign
+// of dot(direction, normal) survives the transform, so front_face stays valid
+inline void object_hit_to_world(const transform& object_to_world, const transform& world_to_object, hit_record& rec) {
+    real error;
+    rec.p = object_to_world.apply_point(rec.p, rec.error, error);
+    rec.error = error * (1 + rounding_gamma(4)) + rounding_gamma(4) * max_abs(rec.p);
+    rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+}
+
+// one placed copy of a shared prototype, e.g. a mesh built once and put in the scene many times
+class instance : public hittable {
+    public:
+        instance(shared_ptr<hittable> prototype, const transform& object_to_world)
+            : prototype(prototype), object_to_world(object_to_world), world_to_object(object_to_world.inverse()),
+              bbox(object_to_world.apply(prototype->bounding_box())) {}
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (!hit_object(*prototype, world_to_object, r, ray_t, rec))
+                return false;
+            object_hit_to_world(object_to_world, world_to_object, rec);
+            return true;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        shared_ptr<hittable> prototype;
+        transform object_to_world;
+        transform world_to_object;
+        aabb bbox;
+};
+
+// two-level acceleration structure: a top-level bvh_tree over many placements of a few
+// prototypes, each prototype with its own tree inside (a sphere_set, triangle_mesh or bvh).
+// a placement is a plain record of a prototype pointer, a material override and the
+// world-to-object matrix, about 112 bytes (64 with RT_USE_FLOAT), so a million copies of a
+// detailed prototype cost little more than the prototype itself
+class instance_set : public hittable {
+    public:
+        // mat, when given, replaces the prototype's materials for this copy
+        void add(shared_ptr<hittable> prototype, const transform& object_to_world, const material* mat = nullptr) {
+            if (known_prototypes.insert(prototype.get()).second)
+                prototypes.push_back(prototype);
+            placements.push_back(placement{prototype.get(), mat, object_to_world.inverse()});
+            boxes.push_back(object_to_world.apply(prototype->bounding_box()));
+        }
+
+        size_t size() const { return placements.size(); }
+
+        // lays the placements out in leaf order; must be called before the set is hit
+        void build() {
+            tree.build(boxes, 2);
+            std::vector<placement> ordered(placements.size());
+            for (size_t k = 0; k < placements.size(); k++)
+                ordered[k] = placements[tree.indices[k]];
+            placements.swap(ordered);
+            boxes.clear();
+            boxes.shrink_to_fit();
+            tree.indices.clear();
+            tree.indices.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            const placement* closest = nullptr;
+            tree.traverse(r, ray_t, [&](int first, int count, interval& t) {
+                bool hit_anything = false;
+                for (int k = first; k < first + count; k++) {
+                    const placement& p = placements[k];
+                    if (hit_object(*p.prototype, p.world_to_object, r, t, rec)) {
+                        closest = &p;
+                        t.max = rec.t;
+                        hit_anything = true;
+                    }
+                }
+                return hit_anything;
+            });
+
+            // only the closest hit is carried to world space, with the forward matrix rebuilt
+            // from the stored inverse instead of keeping both in every placement
+            if (!closest) return false;
+            object_hit_to_world(closest->world_to_object.inverse(), closest->world_to_object, rec);
+            if (closest->mat) rec.mat = closest->mat;
+            return true;
+        }
+
+        aabb bounding_box() const override { return tree.bounds(); }
+
+    private:
+        struct placement {
+            const hittable* prototype;
+            const material* mat;
+            transform world_to_object;
+        };
+
+        std::vector<shared_ptr<hittable>> prototypes; // keeps the placements' prototypes alive
+        std::unordered_set<const hittable*> known_prototypes;
+        std::vector<placement> placements;
+        std::vector<aabb> boxes; // world boxes of the placements until build
+        bvh_tree tree;
+};
+
+#endif
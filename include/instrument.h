@@ -0,0 +1,212 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+// hot-path instrumentation, compiled in only with RT_INSTRUMENT (cmake -DRT_INSTRUMENT=ON).
+// every thread counts into its own instrument_thread, so counting takes no locks and shares
+// no cache lines; the totals are summed when they are reported. without RT_INSTRUMENT the
+// macros below expand to nothing, or to the bare expression for RT_TIMED, and cost nothing
+//   RT_COUNT(field), RT_COUNT_N(field, n)  bump a field of instrument_counters
+//   RT_COUNT_HIT(type)                      a ray hit a surface of this material_type
+//   RT_PATH_END(bounces, cut)               a path ended after this many scatters, cut when
+//                                           it was stopped by max_depth
+//   RT_TIMED(stage, expr)                   evaluates expr, adding its time to the stage
+//   RT_SCOPE(name[, x, y])                  records the enclosing scope as a trace event
+
+#ifdef RT_INSTRUMENT
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class stage { intersect, scatter, tone_map, count };
+
+constexpr const char* stage_names[] = {"intersect", "scatter", "tone_map"};
+constexpr int depth_bins = 64; // path lengths past the last bin are counted in it
+
+struct instrument_counters {
+    uint64_t node_visits = 0;     // bvh nodes whose box was tested against a ray
+    uint64_t primitive_tests = 0; // ray against sphere, sphere lane or triangle
+    uint64_t random_draws = 0;
+    uint64_t hits_by_material[8] = {}; // indexed by material_type
+    uint64_t path_lengths[depth_bins + 1] = {};
+    uint64_t paths_cut = 0; // paths still going when max_depth stopped them
+    uint64_t stage_calls[int(stage::count)] = {};
+    uint64_t stage_nanoseconds[int(stage::count)] = {};
+};
+
+// one complete ("X") event of a chrome trace; x and y are the tile corner for tile events
+struct trace_event {
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    int x, y;
+};
+
+struct instrument_thread {
+    instrument_counters counters;
+    std::vector<trace_event> events;
+    int id = 0;
+};
+
+inline std::chrono::steady_clock::time_point instrument_epoch() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+inline int64_t instrument_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - instrument_epoch()).count();
+}
+
+// every thread that has counted anything, kept until exit so totals can be read after the
+// threads are gone
+inline std::mutex& instrument_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+inline std::vector<std::unique_ptr<instrument_thread>>& instrument_threads() {
+    static std::vector<std::unique_ptr<instrument_thread>> threads;
+    return threads;
+}
+
+inline instrument_thread& this_instrument_thread() {
+    thread_local instrument_thread* self = [] {
+        std::lock_guard<std::mutex> lock(instrument_mutex());
+        auto& threads = instrument_threads();
+        threads.push_back(std::make_unique<instrument_thread>());
+        threads.back()->id = int(threads.size());
+        instrument_epoch();
+        return threads.back().get();
+    }();
+    return *self;
+}
+
+inline void record_path_end(int bounces, bool cut) {
+    auto& c = this_instrument_thread().counters;
+    c.path_lengths[std::min(std::max(bounces, 0), depth_bins)]++;
+    if (cut) c.paths_cut++;
+}
+
+template <typename fn>
+inline auto timed_stage(stage s, fn&& f) {
+    auto& c = this_instrument_thread().counters;
+    int64_t start = instrument_now_ns();
+    struct stop {
+        instrument_counters& c;
+        stage s;
+        int64_t start;
+        ~stop() {
+            c.stage_calls[int(s)]++;
+            c.stage_nanoseconds[int(s)] += uint64_t(instrument_now_ns() - start);
+        }
+    } guard{c, s, start};
+    return f();
+}
+
+class trace_scope {
+    public:
+        trace_scope(const char* name, int x = -1, int y = -1) : name(name), x(x), y(y), start(instrument_now_ns()) {}
+        ~trace_scope() {
+            this_instrument_thread().events.push_back(trace_event{name, start, instrument_now_ns() - start, x, y});
+        }
+
+    private:
+        const char* name;
+        int x, y;
+        int64_t start;
+};
+
+// sums of every thread's counters; only meaningful while no thread is counting
+inline instrument_counters instrument_totals() {
+    std::lock_guard<std::mutex> lock(instrument_mutex());
+    instrument_counters total;
+    for (const auto& t : instrument_threads()) {
+        const auto& c = t->counters;
+        total.node_visits += c.node_visits;
+        total.primitive_tests += c.primitive_tests;
+        total.random_draws += c.random_draws;
+        for (int k = 0; k < 8; k++) total.hits_by_material[k] += c.hits_by_material[k];
+        for (int k = 0; k <= depth_bins; k++) total.path_lengths[k] += c.path_lengths[k];
+        total.paths_cut += c.paths_cut;
+        for (int k = 0; k < int(stage::count); k++) {
+            total.stage_calls[k] += c.stage_calls[k];
+            total.stage_nanoseconds[k] += c.stage_nanoseconds[k];
+        }
+    }
+    return total;
+}
+
+inline void print_instrument_report(std::ostream& out) {
+    instrument_counters c = instrument_totals();
+    uint64_t paths = 0;
+    for (uint64_t n : c.path_lengths) paths += n;
+
+    out << "Instrumentation:\n"
+        << "  bvh node visits: " << c.node_visits << ", primitive tests: " << c.primitive_tests
+        << ", random draws: " << c.random_draws << '\n'
+        << "  hits by material: lambertian " << c.hits_by_material[1] << ", metal " << c.hits_by_material[2]
+        << ", dielectric " << c.hits_by_material[3] << ", light " << c.hits_by_material[4] << '\n';
+    for (int k = 0; k < int(stage::count); k++) {
+        double seconds = c.stage_nanoseconds[k] * 1e-9;
+        out << "  " << stage_names[k] << ": " << c.stage_calls[k] << " calls, " << seconds << "s thread time";
+        if (c.stage_calls[k]) out << ", " << c.stage_nanoseconds[k] / c.stage_calls[k] << "ns each";
+        out << '\n';
+    }
+    out << "  paths: " << paths << ", cut off at max_depth: " << c.paths_cut << '\n'
+        << "  scatters before a path ended:";
+    for (int k = 0; k <= depth_bins; k++)
+        if (c.path_lengths[k]) out << ' ' << k << (k == depth_bins ? "+" : "") << ':' << c.path_lengths[k];
+    out << '\n';
+}
+
+// writes every recorded scope as chrome trace json, for chrome://tracing or ui.perfetto.dev
+inline bool write_chrome_trace(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(instrument_mutex());
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    out << std::fixed << std::setprecision(3);
+    for (const auto& t : instrument_threads()) {
+        for (const auto& e : t->events) {
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->id
+                << ",\"ts\":" << e.start_ns / 1e3 << ",\"dur\":" << e.duration_ns / 1e3;
+            if (e.x >= 0)
+                out << ",\"args\":{\"x\":" << e.x << ",\"y\":" << e.y << '}';
+            out << '}';
+            first = false;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return bool(out);
+}
+
+#define RT_CONCAT_INNER(a, b) a##b
+#define RT_CONCAT(a, b) RT_CONCAT_INNER(a, b)
+#define RT_COUNT(field) (this_instrument_thread().counters.field++)
+#define RT_COUNT_N(field, n) (this_instrument_thread().counters.field += uint64_t(n))
+#define RT_COUNT_HIT(type) (this_instrument_thread().counters.hits_by_material[int(type)]++)
+#define RT_PATH_END(bounces, cut) record_path_end(bounces, cut)
+#define RT_TIMED(name, expr) timed_stage(stage::name, [&] { return expr; })
+#define RT_SCOPE(...) trace_scope RT_CONCAT(rt_scope_, __LINE__)(__VA_ARGS__)
+
+#else
+
+#define RT_COUNT(field) ((void)0)
+#define RT_COUNT_N(field, n) ((void)0)
+#define RT_COUNT_HIT(type) ((void)0)
+#define RT_PATH_END(bounces, cut) ((void)0)
+#define RT_TIMED(name, expr) (expr)
+#define RT_SCOPE(...) ((void)0)
+
+#endif
+
+#endif
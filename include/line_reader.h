@@ -0,0 +1,56 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <charconv>
+#include <string_view>
+
+// whitespace separated fields of one line of a text file (scene files, OBJ)
+class line_reader {
+    public:
+        line_reader(const char* begin, const char* end) : p(begin), end(end) {}
+
+        bool word(std::string_view& out) {
+            skip_space();
+            const char* start = p;
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+            out = std::string_view(start, size_t(p - start));
+            return !out.empty();
+        }
+
+        bool number(double& out) {
+            skip_space();
+            auto [next, ec] = std::from_chars(p, end, out);
+            if (ec != std::errc()) return false;
+            p = next;
+            return true;
+        }
+
+        // integer up to the next non-digit, e.g. the vertex index of an OBJ face corner like 12/4/7
+        bool integer(long long& out) {
+            skip_space();
+            auto [next, ec] = std::from_chars(p, end, out);
+            if (ec != std::errc()) return false;
+            p = next;
+            return true;
+        }
+
+        // skips the rest of the current field
+        void skip_word() {
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        }
+
+        bool at_end() {
+            skip_space();
+            return p == end || *p == '#';
+        }
+
+    private:
+        const char* p;
+        const char* end;
+
+        void skip_space() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        }
+};
+
+#endif
@@ -2,60 +2,68 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "pdf.h"
+#include "arena.h"
 
-class material {
-        public: 
-            virtual ~material() = default;
+#include <variant>
 
-            virtual bool scatter(
-                const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-            ) const {
-                return false;
-            }
-};
+// lets batched shading group hits by material kind before calling scatter
+enum class material_type { none, lambertian, metal, dielectric, diffuse_light };
 
 
-class lambertian : public material {
+class lambertian {
     public:
         lambertian(const color& albedo) : albedo(albedo) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            auto scatter_direction = rec.normal + random_unit_vector();
-
-            if (scatter_direction.near_zero())
-                scatter_direction = rec.normal;
-
-            scattered = ray(rec.p, scatter_direction);
+        // directions are importance sampled by the cosine term, so the brdf times the cosine
+        // over the pdf leaves just the albedo
+        bool scatter(const ray& /*r_in*/, const hit_record& rec, sampler& s, color& attenuation, ray& scattered) const {
+            scattered = rec.spawn_ray(cosine_pdf(rec.normal).generate(s.get_2d()));
             attenuation = albedo;
             return true;
         }
+
+        double scattering_pdf(const ray& /*r_in*/, const hit_record& rec, const vec3& direction) const {
+            return cosine_pdf(rec.normal).value(direction);
+        }
+
+        // brdf times cosine for light leaving along -r_in that arrived from direction
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return albedo * real(scattering_pdf(r_in, rec, direction));
+        }
+
+        const color& get_albedo() const { return albedo; }
+
     private:
         color albedo;
 };
 
 
-class metal : public material {
+class metal {
     public:
         metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, sampler& s, color& attenuation, ray& scattered) const {
             vec3 reflected = reflect(r_in.direction(), rec.normal);
-            reflected= unit_vector(reflected) + (fuzz * random_unit_vector());
-            scattered = ray(rec.p, reflected);
+            reflected= unit_vector(reflected) + (fuzz * sample_unit_sphere(s.get_2d()));
+            scattered = rec.spawn_ray(reflected);
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
+
+        const color& get_albedo() const { return albedo; }
+
     private:
         color albedo;
         double fuzz;
 };
 
-class dielectric : public material {
+class dielectric {
   public:
     dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
+    bool scatter(const ray& r_in, const hit_record& rec, sampler& s, color& attenuation, ray& scattered)
+    const {
         attenuation = color(1.0, 1.0, 1.0);
         double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -66,13 +74,13 @@ class dielectric : public material {
         bool cannot_refract = ri * sin_theta > 1.0;
         vec3 direction; 
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double()) {
+        if (cannot_refract || reflectance(cos_theta, ri) > s.get_1d()) {
             direction = reflect(unit_direction, rec.normal);
         } else {
             direction = refract(unit_direction, rec.normal, ri);
         }
 
-        scattered = ray(rec.p, direction);
+        scattered = rec.spawn_ray(direction);
         return true;
     };
 
@@ -86,4 +94,104 @@ class dielectric : public material {
     }
 };
 
-#endif
\ No newline at end of file
+
+// emits light from its front face and scatters nothing
+class diffuse_light {
+    public:
+        diffuse_light(const color& emit) : emit(emit) {}
+
+        color emitted(const ray& /*r_in*/, const hit_record& rec) const {
+            return rec.front_face ? emit : color(0,0,0);
+        }
+
+    private:
+        color emit;
+};
+
+
+// one of the closed set of surface models above. scatter draws its numbers from the sampler of
+// the pixel sample being traced. it switches on the stored kind and
+// calls the model directly, so shading costs no virtual call and hit_record can point at
+// a material without owning it.
+// light sampling needs the density of the scattered direction and the brdf itself; both are
+// known only for lambertian. metal and dielectric scatter into (near) delta lobes, are
+// specular and are never connected to a light
+class material {
+    public:
+        material(const lambertian& m) : model(m) {}
+        material(const metal& m) : model(m) {}
+        material(const dielectric& m) : model(m) {}
+        material(const diffuse_light& m) : model(m) {}
+
+        // variant alternatives are declared in material_type order, after none
+        material_type type() const { return material_type(model.index() + 1); }
+
+        bool scatter(const ray& r_in, const hit_record& rec, sampler& s, color& attenuation, ray& scattered) const {
+            switch (type()) {
+                case material_type::lambertian:
+                    return std::get_if<lambertian>(&model)->scatter(r_in, rec, s, attenuation, scattered);
+                case material_type::metal:
+                    return std::get_if<metal>(&model)->scatter(r_in, rec, s, attenuation, scattered);
+                case material_type::dielectric:
+                    return std::get_if<dielectric>(&model)->scatter(r_in, rec, s, attenuation, scattered);
+                default:
+                    return false;
+            }
+        }
+
+        bool emits() const { return type() == material_type::diffuse_light; }
+
+        color emitted(const ray& r_in, const hit_record& rec) const {
+            if (!emits()) return color(0,0,0);
+            return std::get_if<diffuse_light>(&model)->emitted(r_in, rec);
+        }
+
+        bool specular() const { return type() != material_type::lambertian; }
+
+        // surface colour recorded in the denoiser's albedo buffer: the reflectance of lambertian
+        // and metal, white for glass and lights, which tint nothing they pass on
+        color albedo() const {
+            switch (type()) {
+                case material_type::lambertian:
+                    return std::get_if<lambertian>(&model)->get_albedo();
+                case material_type::metal:
+                    return std::get_if<metal>(&model)->get_albedo();
+                default:
+                    return color(1, 1, 1);
+            }
+        }
+
+        // solid-angle density with which scatter picks direction, 0 for specular materials
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            if (type() != material_type::lambertian) return 0.0;
+            return std::get_if<lambertian>(&model)->scattering_pdf(r_in, rec, direction);
+        }
+
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            if (type() != material_type::lambertian) return color(0,0,0);
+            return std::get_if<lambertian>(&model)->eval(r_in, rec, direction);
+        }
+
+    private:
+        std::variant<lambertian, metal, dielectric, diffuse_light> model;
+};
+
+
+// owns the materials of a scene. they are packed into arena chunks that never move, so the
+// pointers handed out by add stay valid for the table's lifetime, and a million materials cost
+// a few dozen allocations
+class material_table {
+    public:
+        const material* add(const material& m) {
+            count++;
+            return storage.make<material>(m);
+        }
+
+        size_t size() const { return count; }
+
+    private:
+        arena storage{std::size_t(64) << 10};
+        size_t count = 0;
+};
+
+#endif
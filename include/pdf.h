@@ -0,0 +1,70 @@
+#ifndef PDF_H
+#define PDF_H
+
+#include "constants.h"
+#include "sampler.h"
+
+// orthonormal basis around a direction, w pointing along it
+class onb {
+    public:
+        onb(const vec3& n) {
+            axis[2] = unit_vector(n);
+            vec3 a = (std::fabs(axis[2].x()) > real(0.9)) ? vec3(0,1,0) : vec3(1,0,0);
+            axis[1] = unit_vector(cross(axis[2], a));
+            axis[0] = cross(axis[2], axis[1]);
+        }
+
+        const vec3& u() const { return axis[0]; }
+        const vec3& v() const { return axis[1]; }
+        const vec3& w() const { return axis[2]; }
+
+        // from basis coordinates to world
+        vec3 transform(const vec3& v) const {
+            return (v[0] * axis[0]) + (v[1] * axis[1]) + (v[2] * axis[2]);
+        }
+
+    private:
+        vec3 axis[3];
+};
+
+// directions about a normal with density cos(theta) / pi. a point on the unit sphere offset by
+// the normal lands on that distribution exactly
+class cosine_pdf {
+    public:
+        cosine_pdf(const vec3& normal) : normal(normal) {}
+
+        double value(const vec3& direction) const {
+            double cosine = dot(unit_vector(direction), normal);
+            return cosine <= 0 ? 0 : cosine / pi;
+        }
+
+        vec3 generate(const sample2& u) const {
+            vec3 direction = normal + sample_unit_sphere(u);
+            return direction.near_zero() ? normal : direction;
+        }
+
+    private:
+        vec3 normal;
+};
+
+// uniform direction inside the cone that a sphere of the given radius subtends from a point at
+// distance_squared from its center, in coordinates about the axis to the center
+inline vec3 random_to_sphere(double radius, double distance_squared, const sample2& u) {
+    auto r1 = u.u;
+    auto r2 = u.v;
+    auto z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
+
+    auto phi = 2 * pi * r1;
+    auto x = std::cos(phi) * std::sqrt(1 - z * z);
+    auto y = std::sin(phi) * std::sqrt(1 - z * z);
+    return vec3(real(x), real(y), real(z));
+}
+
+// weight of a sample drawn with density a when another strategy could have drawn it with
+// density b (veach's power heuristic, exponent 2)
+inline double power_heuristic(double a, double b) {
+    double a2 = a * a, b2 = b * b;
+    return a2 + b2 > 0 ? a2 / (a2 + b2) : 0;
+}
+
+#endif
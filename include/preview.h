@@ -0,0 +1,86 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "deflate.h"
+#include "distributed.h"
+#include "image_buffer.h"
+#include "tile_scheduler.h"
+#include "tone_map.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// wire format of the interactive preview, over one tcp connection to localhost:
+//   renderer -> preview_hello, the image size and the view it starts from
+//   viewer   -> preview_view, at any time: the camera to render from now on
+//   renderer -> preview_tile_header and the tile's pixels, for every tile of every pass, and a
+//               header with x0 < 0 when a pass is complete
+// each view first gets a coarse pass that traces one sample per block of preview_block pixels,
+// then full-resolution passes of growing sample counts. pixels are 8-bit rgb, a tile's rows
+// one after another, or one pixel per block for a coarse tile. everything the renderer sends
+// after the hello is one zlib stream, flushed after every tile, so a tile can refer back to the
+// pixels of earlier ones. values go out in host byte order, as in distributed.h
+struct preview_view {
+    double lookfrom[3];
+    double lookat[3];
+    double vfov;
+    double defocus_angle;
+    double focus_dist;
+};
+
+struct preview_hello {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    preview_view view;
+};
+
+constexpr char preview_magic[8] = {'R', 'T', 'P', 'R', 'E', 'V', '0', '1'};
+
+// edge of the pixel blocks of a view's first, coarse pass
+constexpr int preview_block = 4;
+
+struct preview_tile_header {
+    int32_t x0, y0, x1, y1;
+    uint32_t view;    // number of preview_view messages the renderer had applied
+    uint32_t samples; // samples per pixel reached by the pass, 0 for the coarse pass
+    uint32_t block;   // 1, or preview_block for a coarse tile
+    uint32_t size;    // compressed bytes that follow
+};
+
+// number of pixels along an edge of length n that a pass with this block size sends
+inline int preview_block_count(int n, int block) {
+    return (n + block - 1) / block;
+}
+
+// the pixels of t tone mapped to 8-bit rgb, taking the top left pixel of every block
+inline void append_preview_pixels(const image_buffer& image, const tile& t, int block, const tone_mapping& tone, std::vector<uint8_t>& bytes) {
+    std::vector<accum_pixel> row;
+    for (int y = t.y0; y < t.y1; y += block) {
+        row.clear();
+        for (int x = t.x0; x < t.x1; x += block)
+            row.push_back(image.accum_at(y, x));
+        size_t start = bytes.size();
+        bytes.resize(start + 3 * row.size());
+        tone.apply(row.data(), int(row.size()), bytes.data() + start);
+    }
+}
+
+// the inverse of append_preview_pixels, which fills every block with its pixel. a byte b is
+// stored as the radiance (b / 256)^2, one sample's worth, which the default tone_mapping
+// turns back into b exactly, so the viewer writes the pixels it was sent
+inline void store_preview_pixels(image_buffer& image, const tile& t, int block, const uint8_t* bytes) {
+    for (int y = t.y0; y < t.y1; y += block) {
+        for (int x = t.x0; x < t.x1; x += block) {
+            float r = bytes[0] / 256.0f, g = bytes[1] / 256.0f, b = bytes[2] / 256.0f;
+            accum_pixel p{r * r, g * g, b * b, 1, 0};
+            bytes += 3;
+            for (int by = y; by < std::min(y + block, t.y1); by++)
+                for (int bx = x; bx < std::min(x + block, t.x1); bx++)
+                    image.store_accum(by, bx, p);
+        }
+    }
+}
+
+#endif
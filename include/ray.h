@@ -13,7 +13,7 @@ class ray {
         const point3& origin() const { return orig; }
         const vec3& direction() const { return dir; }
 
-        point3 at(double t) const {
+        point3 at(real t) const {
             return orig + t* dir;
         }
 
@@ -22,4 +22,22 @@ class ray {
         vec3 dir;
 };
 
+// origin for a ray leaving a surface point p whose coordinates are each within error of the
+// true surface point. p is pushed along the normal n, to the side direction w leaves on, by
+// more than that error and then rounded one step further away, so the new ray cannot find
+// the surface it starts on again. this replaces a fixed minimum hit distance, which is too
+// small for far-off points in single precision and needlessly large near the origin
+inline point3 offset_ray_origin(const point3& p, real error, const vec3& n, const vec3& w) {
+    real d = error * (std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z()));
+    vec3 offset = d * n;
+    if (dot(w, n) < 0)
+        offset = -offset;
+    point3 po = p + offset;
+    for (int i = 0; i < 3; i++) {
+        if (offset[i] > 0) po[i] = std::nextafter(po[i], infinity);
+        else if (offset[i] < 0) po[i] = std::nextafter(po[i], -infinity);
+    }
+    return po;
+}
+
 #endif
\ No newline at end of file
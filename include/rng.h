@@ -0,0 +1,74 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// splitmix64 finalizer, used to expand seeds and to hash pixel/sample coordinates into seeds
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hash_seed(uint64_t a, uint64_t b) {
+    return mix64(a ^ mix64(b));
+}
+
+inline uint64_t hash_seed(uint64_t a, uint64_t b, uint64_t c) {
+    return hash_seed(hash_seed(a, b), c);
+}
+
+// xoshiro256+ generator. small, lock-free and fast enough to keep one per render thread;
+// the top 53 bits of each output are used to build doubles in [0,1)
+class rng {
+    public:
+        constexpr rng() : s{0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull} {}
+
+        explicit rng(uint64_t seed_value) { seed(seed_value); }
+
+        void seed(uint64_t seed_value) {
+            for (auto& word : s) {
+                seed_value = mix64(seed_value);
+                word = seed_value;
+            }
+        }
+
+        uint64_t next() {
+            uint64_t result = s[0] + s[3];
+            uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+        double next_double() {
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+    private:
+        uint64_t s[4];
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+};
+
+// every thread owns its generator, so sampling never shares state or takes a lock.
+// the render loop reseeds it per pixel sample so images don't depend on the thread count
+inline rng& thread_rng() {
+    static thread_local rng generator;
+    return generator;
+}
+
+inline void seed_thread_rng(uint64_t seed_value) {
+    thread_rng().seed(seed_value);
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "constants.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// where the numbers of a pixel sample come from. every sampler is a function of the render
+// seed, the pixel and the sample index alone, so images don't depend on the thread count:
+//   independent - uniform random numbers, error falls as 1/sqrt(n)
+//   stratified  - each dimension (or pair) split into samples_per_pixel strata, one sample in
+//                 each, the strata visited in a random order per pixel and dimension
+//   sobol       - the (0,2) sequence in every pair of dimensions, owen-scrambled and with the
+//                 sample order shuffled per pixel and dimension; every power-of-two prefix is
+//                 stratified, which suits adaptive and progressive sampling
+//   blue_noise  - the same scrambled sobol points in every pixel, each pixel's shifted by a
+//                 blue-noise mask, which leaves the remaining error as high-frequency noise
+enum class sampler_type { independent, stratified, sobol, blue_noise };
+
+struct sample2 {
+    double u, v;
+};
+
+// uniform point on the unit sphere
+inline vec3 sample_unit_sphere(const sample2& s) {
+    double z = 1 - 2 * s.u;
+    double r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * s.v;
+    return vec3(real(r * std::cos(phi)), real(r * std::sin(phi)), real(z));
+}
+
+// uniform point in the unit disk (z = 0) by the concentric map, which keeps strata compact
+inline vec3 sample_unit_disk(const sample2& s) {
+    double a = 2 * s.u - 1, b = 2 * s.v - 1;
+    if (a == 0 && b == 0) return vec3(0,0,0);
+    double r, theta;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(real(r * std::cos(theta)), real(r * std::sin(theta)), 0);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// owen scrambling by hashing (burley, "practical hash-based owen scrambling"). the hash only
+// carries changes from low bits to high ones, so applied to the reversed value every digit is
+// permuted depending on the digits above it
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// the first two sobol dimensions: van der corput, and the one whose generator matrix is
+// pascal's triangle mod 2. together they form a (0,2) sequence
+inline uint32_t sobol_x(uint32_t index) {
+    return reverse_bits(index);
+}
+
+inline uint32_t sobol_y(uint32_t index) {
+    static constexpr std::array<uint32_t, 32> directions = [] {
+        std::array<uint32_t, 32> v{};
+        v[0] = 1u << 31;
+        for (int k = 1; k < 32; k++)
+            v[k] = v[k - 1] ^ (v[k - 1] >> 1);
+        return v;
+    }();
+    uint32_t x = 0;
+    for (int bit = 0; index; bit++, index >>= 1)
+        if (index & 1) x ^= directions[bit];
+    return x;
+}
+
+// element i of a random permutation of [0, l) chosen by p, without storing the permutation
+// (kensler, "correlated multi-jittered sampling")
+inline uint32_t permutation_element(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// blue-noise dither mask, blue_noise_size squared values in [0,1), made once by
+// void-and-cluster (ulichney): each value is the rank at which its cell was filled, and cells
+// are filled in the largest remaining void of a gaussian-filtered, wrapping energy
+constexpr int blue_noise_size = 64;
+
+inline const std::vector<float>& blue_noise_mask() {
+    static const std::vector<float> mask = [] {
+        constexpr int n = blue_noise_size;
+        constexpr int cells = n * n;
+        constexpr double sigma = 1.5;
+
+        std::vector<double> kernel(cells); // gaussian of the wrapped offset between two cells
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                int dx = std::min(x, n - x), dy = std::min(y, n - y);
+                kernel[y * n + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<unsigned char> on(cells, 0);
+        std::vector<double> energy(cells, 0);
+        auto toggle = [&](int cell, double sign) {
+            on[cell] ^= 1;
+            int cx = cell % n, cy = cell / n;
+            for (int y = 0; y < n; y++) {
+                const double* row = &kernel[((y - cy + n) % n) * n];
+                for (int x = 0; x < n; x++)
+                    energy[y * n + x] += sign * row[(x - cx + n) % n];
+            }
+        };
+        // tightest cluster: the set cell with most energy; largest void: the empty one with least
+        auto extreme = [&](unsigned char state, bool most) {
+            int best = -1;
+            for (int c = 0; c < cells; c++) {
+                if (on[c] != state) continue;
+                if (best < 0 || (most ? energy[c] > energy[best] : energy[c] < energy[best]))
+                    best = c;
+            }
+            return best;
+        };
+
+        // a random tenth of the cells, relaxed by moving the tightest cluster to the largest void
+        rng random(0x626c7565u);
+        int initial = cells / 10;
+        for (int placed = 0; placed < initial;) {
+            int c = int(random.next() % cells);
+            if (!on[c]) {
+                toggle(c, 1);
+                placed++;
+            }
+        }
+        for (int step = 0; step < cells; step++) {
+            int cluster = extreme(1, true);
+            toggle(cluster, -1);
+            int void_cell = extreme(0, false);
+            if (void_cell == cluster) {
+                toggle(cluster, 1);
+                break;
+            }
+            toggle(void_cell, 1);
+        }
+
+        std::vector<int> rank(cells, 0);
+        std::vector<unsigned char> pattern = on;
+        std::vector<double> pattern_energy = energy;
+        // ranks below the initial pattern: remove its tightest clusters one by one
+        for (int r = initial - 1; r >= 0; r--) {
+            int cluster = extreme(1, true);
+            toggle(cluster, -1);
+            rank[cluster] = r;
+        }
+        // ranks above it: fill the largest voids
+        on = pattern;
+        energy = pattern_energy;
+        for (int r = initial; r < cells; r++) {
+            int void_cell = extreme(0, false);
+            toggle(void_cell, 1);
+            rank[void_cell] = r;
+        }
+
+        std::vector<float> values(cells);
+        for (int c = 0; c < cells; c++)
+            values[c] = float((rank[c] + 0.5) / cells);
+        return values;
+    }();
+    return mask;
+}
+
+// the numbers of one pixel sample, drawn one or two dimensions at a time. the pixel position
+// takes dimensions 0 and 1, the lens 2 and 3, and every bounce a block of its own after that,
+// so a bounce always draws from the same dimensions whatever the bounces before it used
+class sampler {
+    public:
+        static constexpr int first_bounce_dimension = 4;
+        static constexpr int bounce_dimensions = 8;
+
+        sampler() = default;
+        sampler(sampler_type type, uint64_t seed, int samples_per_pixel, int image_width)
+            : type(type), seed(seed), samples_per_pixel(std::max(1, samples_per_pixel)), image_width(image_width) {
+            if (type == sampler_type::blue_noise)
+                blue_noise_mask();
+        }
+
+        sampler_type kind() const { return type; }
+
+        // starts sample index of pixel (i, j) at dimension 0. the thread's random stream is
+        // seeded from the same coordinates, for the independent sampler and any other use
+        void start_pixel_sample(int i, int j, int index) {
+            px = i;
+            py = j;
+            sample_index = uint32_t(index);
+            pixel_seed = hash_seed(seed, uint64_t(j) * image_width + i);
+            dimension = 0;
+            seed_thread_rng(hash_seed(pixel_seed, uint64_t(index)));
+        }
+
+        void start_bounce(int bounce) {
+            dimension = first_bounce_dimension + bounce * bounce_dimensions;
+        }
+
+        double get_1d() {
+            int d = dimension++;
+            switch (type) {
+                case sampler_type::stratified: {
+                    uint32_t n = uint32_t(samples_per_pixel);
+                    if (sample_index >= n) return random_double();
+                    uint32_t stratum = permutation_element(sample_index, n, dimension_hash(d));
+                    return (stratum + jitter(d, 0)) / n;
+                }
+                case sampler_type::sobol: {
+                    uint32_t h = dimension_hash(d);
+                    uint32_t index = nested_uniform_scramble(sample_index, h);
+                    return to_unit(nested_uniform_scramble(sobol_x(index), h * 0x9e3779b9u + 1));
+                }
+                case sampler_type::blue_noise: {
+                    uint32_t h = shared_hash(d);
+                    uint32_t index = nested_uniform_scramble(sample_index, h);
+                    return shift(to_unit(nested_uniform_scramble(sobol_x(index), h * 0x9e3779b9u + 1)), mask_value(h, 0));
+                }
+                default:
+                    return random_double();
+            }
+        }
+
+        sample2 get_2d() {
+            int d = dimension;
+            dimension += 2;
+            switch (type) {
+                case sampler_type::stratified: {
+                    uint32_t n = uint32_t(samples_per_pixel);
+                    if (sample_index >= n) return independent_2d();
+                    uint32_t side = uint32_t(std::sqrt(double(n)) + 0.5);
+                    if (side * side == n) {
+                        uint32_t stratum = permutation_element(sample_index, n, dimension_hash(d));
+                        return sample2{(stratum % side + jitter(d, 0)) / side, (stratum / side + jitter(d, 1)) / side};
+                    }
+                    // latin hypercube when n is not a square: each axis stratified on its own
+                    return sample2{(permutation_element(sample_index, n, dimension_hash(d)) + jitter(d, 0)) / n,
+                                   (permutation_element(sample_index, n, dimension_hash(d + 1)) + jitter(d, 1)) / n};
+                }
+                case sampler_type::sobol: {
+                    uint32_t h = dimension_hash(d);
+                    return sobol_2d(h);
+                }
+                case sampler_type::blue_noise: {
+                    uint32_t h = shared_hash(d);
+                    sample2 s = sobol_2d(h);
+                    return sample2{shift(s.u, mask_value(h, 0)), shift(s.v, mask_value(h, 1))};
+                }
+                default:
+                    return independent_2d();
+            }
+        }
+
+    private:
+        sampler_type type = sampler_type::independent;
+        uint64_t seed = 0;
+        int samples_per_pixel = 1;
+        int image_width = 1;
+        int px = 0, py = 0;
+        uint32_t sample_index = 0;
+        uint64_t pixel_seed = 0;
+        int dimension = 0;
+
+        static double to_unit(uint32_t x) { return x * 0x1p-32; }
+
+        static double shift(double x, double offset) {
+            x += offset;
+            return x >= 1 ? x - 1 : x;
+        }
+
+        sample2 independent_2d() {
+            double u = random_double();
+            return sample2{u, random_double()};
+        }
+
+        // scrambles differ per pixel and dimension
+        uint32_t dimension_hash(int d) const {
+            return uint32_t(hash_seed(pixel_seed, uint64_t(d)));
+        }
+
+        // one scramble per dimension shared by every pixel, for blue_noise
+        uint32_t shared_hash(int d) const {
+            return uint32_t(hash_seed(seed, ~uint64_t(0), uint64_t(d)));
+        }
+
+        double jitter(int d, int axis) const {
+            return (hash_seed(pixel_seed, uint64_t(d) * 2 + axis, sample_index) >> 11) * 0x1p-53;
+        }
+
+        sample2 sobol_2d(uint32_t h) const {
+            uint32_t index = nested_uniform_scramble(sample_index, h);
+            return sample2{to_unit(nested_uniform_scramble(sobol_x(index), h * 0x9e3779b9u + 1)),
+                           to_unit(nested_uniform_scramble(sobol_y(index), h * 0x85ebca6bu + 2))};
+        }
+
+        // the pixel's mask value, the mask moved by a different offset for every dimension
+        double mask_value(uint32_t h, int axis) const {
+            constexpr int mask = blue_noise_size - 1;
+            uint32_t offset = axis ? (h >> 16) : h;
+            int x = (px + int(offset & mask)) & mask;
+            int y = (py + int((offset >> 8) & mask)) & mask;
+            return blue_noise_mask()[size_t(y) * blue_noise_size + x];
+        }
+};
+
+#endif
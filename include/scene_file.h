@@ -0,0 +1,583 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "constants.h"
+#include "material.h"
+#include "sphere_set.h"
+#include "scenes.h"
+#include "line_reader.h"
+#include "triangle_mesh.h"
+#include "thread_pool.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// scenes on disk come in two forms that carry the same content.
+//
+// the text form is line based, for writing by hand. '#' starts a comment, and the lines are
+//     aspect_ratio 1.7778            image_width 400          samples_per_pixel 100
+//     max_depth 50                   vfov 20                  defocus_angle 0.6
+//     focus_dist 10                  lookfrom 13 2 3          lookat 0 0 0          vup 0 1 0
+//     background <r> <g> <b>         (replaces the sky gradient)
+//     material <name> lambertian <r> <g> <b>
+//     material <name> metal <r> <g> <b> <fuzz>
+//     material <name> dielectric <refraction_index>
+//     material <name> light <r> <g> <b>            (emitted radiance, may exceed 1)
+//     sphere <x> <y> <z> <radius> <material name>
+//     mesh <file.obj> <material name>
+// in any order; a sphere may name a material declared further down. mesh paths are relative
+// to the scene file. spheres and meshes made of a light material become the camera's lights.
+// every number must be finite, and a camera that cannot see anything (camera_desc::validate) is
+// refused, in either form.
+//
+// the binary form is a scene_file_header followed by the material_desc and sphere_desc arrays,
+// exactly as they sit in memory. it is memory-mapped and its spheres are copied into the
+// sphere_set's staging arrays without parsing.
+// the mesh references follow at the end, each a material index, a path length and the path
+
+struct camera_desc {
+    double aspect_ratio = 16.0 / 9.0;
+    double vfov = 90;
+    double lookfrom[3] = {0, 0, 0};
+    double lookat[3] = {0, 0, -1};
+    double vup[3] = {0, 1, 0};
+    double defocus_angle = 0;
+    double focus_dist = 10;
+    int32_t image_width = 400;
+    int32_t samples_per_pixel = 10;
+    int32_t max_depth = 10;
+    int32_t sky = 1; // 0 when background replaces the sky gradient
+    double background[3] = {0, 0, 0};
+
+    void apply(camera& cam) const {
+        cam.aspect_ratio      = aspect_ratio;
+        cam.image_width       = image_width;
+        cam.samples_per_pixel = samples_per_pixel;
+        cam.max_depth         = max_depth;
+        cam.vfov              = vfov;
+        cam.lookfrom          = point3(lookfrom[0], lookfrom[1], lookfrom[2]);
+        cam.lookat            = point3(lookat[0], lookat[1], lookat[2]);
+        cam.vup               = vec3(vup[0], vup[1], vup[2]);
+        cam.defocus_angle     = defocus_angle;
+        cam.focus_dist        = focus_dist;
+        cam.sky               = sky != 0;
+        cam.background        = color(background[0], background[1], background[2]);
+    }
+
+    // refuses settings that leave the camera without a view: a value that is not finite, a field
+    // of view outside (0, 180) degrees, lookat on lookfrom, vup along the view direction, or an
+    // image without pixels, samples or bounces
+    void validate(const std::string& path) const {
+        const double values[] = {aspect_ratio, vfov, lookfrom[0], lookfrom[1], lookfrom[2], lookat[0], lookat[1], lookat[2],
+                                 vup[0], vup[1], vup[2], defocus_angle, focus_dist, background[0], background[1], background[2]};
+        for (double v : values)
+            if (!std::isfinite(v))
+                throw std::runtime_error(path + ": camera settings must be finite numbers");
+
+        double view[3] = {lookat[0] - lookfrom[0], lookat[1] - lookfrom[1], lookat[2] - lookfrom[2]};
+        double side[3] = {vup[1] * view[2] - vup[2] * view[1], vup[2] * view[0] - vup[0] * view[2], vup[0] * view[1] - vup[1] * view[0]};
+        double image_height = image_width / aspect_ratio;
+        if (!(vfov > 0 && vfov < 180))
+            throw std::runtime_error(path + ": vfov must lie between 0 and 180 degrees");
+        if (view[0] == 0 && view[1] == 0 && view[2] == 0)
+            throw std::runtime_error(path + ": lookfrom and lookat must differ");
+        if (side[0] == 0 && side[1] == 0 && side[2] == 0)
+            throw std::runtime_error(path + ": vup must not point along the view direction");
+        if (!(defocus_angle >= 0 && defocus_angle < 180) || !(focus_dist > 0))
+            throw std::runtime_error(path + ": defocus_angle must lie in [0, 180) degrees and focus_dist be positive");
+        if (image_width <= 0 || !(aspect_ratio > 0) || !(image_height >= 1 && image_height <= INT32_MAX))
+            throw std::runtime_error(path + ": image width and height must be positive");
+        if (samples_per_pixel <= 0 || max_depth <= 0)
+            throw std::runtime_error(path + ": samples_per_pixel and max_depth must be positive");
+    }
+};
+
+// albedo in params[0..2] plus fuzz in params[3] for metal, refraction index in params[0] for dielectric,
+// emitted radiance in params[0..2] for light
+struct material_desc {
+    material_type type;
+    uint32_t reserved;
+    double params[4];
+};
+
+struct sphere_desc {
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t reserved;
+};
+
+struct scene_file_header {
+    char magic[8];
+    uint32_t material_count;
+    uint32_t mesh_count;
+    uint64_t sphere_count;
+    camera_desc camera;
+};
+
+static_assert(sizeof(material_desc) == 40 && sizeof(sphere_desc) == 40, "scene file records must keep their layout");
+static_assert(sizeof(scene_file_header) % 8 == 0, "records after the header must stay 8-byte aligned");
+
+constexpr char scene_file_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '2'};
+// the first version's camera had no background; its files are refused rather than misread
+constexpr char scene_file_magic_v1[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '1'};
+
+// an OBJ file placed in the scene as written, the path is resolved against the scene file's directory
+struct mesh_desc {
+    std::string path;
+    uint32_t material;
+};
+
+// a parsed text scene. its spheres are only kept when it is to be written back out in the
+// binary form; a scene being loaded has them parsed straight into its sphere_set
+struct scene_description {
+    camera_desc camera;
+    std::vector<std::string> material_names;
+    std::vector<material_desc> materials;
+    std::vector<sphere_desc> spheres;
+    std::vector<mesh_desc> meshes;
+    std::vector<std::string> mesh_material_names; // resolved into meshes[k].material once all materials are known
+};
+
+// where parse_scene_text puts the spheres: begin(desc, count) is called once the materials are
+// known and before any sphere, then set(index, record) once for every index below count, from
+// several threads at a time
+struct description_spheres {
+    scene_description* desc = nullptr;
+
+    void begin(scene_description& d, size_t count) {
+        desc = &d;
+        desc->spheres.resize(count);
+    }
+    void set(size_t index, const sphere_desc& record) { desc->spheres[index] = record; }
+};
+
+// read-only view of a whole file, released on destruction
+class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("cannot open scene file: " + path);
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                length = size_t(st.st_size);
+                void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    ::madvise(p, length, MADV_SEQUENTIAL);
+                    bytes = static_cast<const char*>(p);
+                }
+            }
+            ::close(fd);
+            if (length > 0 && !bytes)
+                throw std::runtime_error("cannot map scene file: " + path);
+        }
+
+        ~mapped_file() {
+            if (bytes) ::munmap(const_cast<char*>(bytes), length);
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const char* bytes = nullptr;
+        size_t length = 0;
+};
+
+inline int loader_threads(size_t work_items) {
+    int cores = int(std::max(1u, std::thread::hardware_concurrency()));
+    // below this a chunk costs more to start than to parse
+    constexpr size_t min_items_per_thread = 1 << 16;
+    return int(std::clamp<size_t>(work_items / min_items_per_thread, 1, size_t(cores)));
+}
+
+inline std::runtime_error parse_error(const std::string& path, const char* text, const char* at, const std::string& what) {
+    size_t line = 1 + size_t(std::count(text, at, '\n'));
+    return std::runtime_error(path + ":" + std::to_string(line) + ": " + what);
+}
+
+inline void read_vector(line_reader& in, double out[3], bool& ok) {
+    ok = in.number(out[0]) && in.number(out[1]) && in.number(out[2]);
+}
+
+// everything except sphere lines: camera settings and materials
+inline void parse_directive(const std::string& path, const char* text, const char* line, const char* line_end,
+                            scene_description& desc) {
+    line_reader in(line, line_end);
+    std::string_view key;
+    in.word(key);
+
+    bool ok = true;
+    double value = 0;
+    camera_desc& cam = desc.camera;
+    if (key == "lookfrom") read_vector(in, cam.lookfrom, ok);
+    else if (key == "lookat") read_vector(in, cam.lookat, ok);
+    else if (key == "vup") read_vector(in, cam.vup, ok);
+    else if (key == "background") {
+        read_vector(in, cam.background, ok);
+        cam.sky = 0;
+    }
+    else if (key == "mesh") {
+        std::string_view mesh_path, name;
+        ok = in.word(mesh_path) && in.word(name);
+        if (ok) {
+            desc.meshes.push_back(mesh_desc{std::string(mesh_path), 0});
+            desc.mesh_material_names.emplace_back(name);
+        }
+    } else if (key == "material") {
+        std::string_view name, kind;
+        material_desc m{};
+        ok = in.word(name) && in.word(kind);
+        if (ok && kind == "lambertian") {
+            m.type = material_type::lambertian;
+            ok = in.number(m.params[0]) && in.number(m.params[1]) && in.number(m.params[2]);
+        } else if (ok && kind == "metal") {
+            m.type = material_type::metal;
+            ok = in.number(m.params[0]) && in.number(m.params[1]) && in.number(m.params[2]) && in.number(m.params[3]);
+        } else if (ok && kind == "dielectric") {
+            m.type = material_type::dielectric;
+            ok = in.number(m.params[0]);
+        } else if (ok && kind == "light") {
+            m.type = material_type::diffuse_light;
+            ok = in.number(m.params[0]) && in.number(m.params[1]) && in.number(m.params[2]);
+        } else if (ok) {
+            throw parse_error(path, text, line, "unknown material kind '" + std::string(kind) + "'");
+        }
+        if (ok && !std::all_of(m.params, m.params + 4, [](double v) { return std::isfinite(v); }))
+            throw parse_error(path, text, line, "material values must be finite numbers");
+        if (ok) {
+            desc.material_names.emplace_back(name);
+            desc.materials.push_back(m);
+        }
+    } else if (in.number(value)) {
+        bool integer_key = key == "image_width" || key == "samples_per_pixel" || key == "max_depth";
+        if (integer_key && !(value >= INT32_MIN && value <= INT32_MAX))
+            throw parse_error(path, text, line, "'" + std::string(key) + "' is out of range");
+        if (key == "aspect_ratio") cam.aspect_ratio = value;
+        else if (key == "vfov") cam.vfov = value;
+        else if (key == "defocus_angle") cam.defocus_angle = value;
+        else if (key == "focus_dist") cam.focus_dist = value;
+        else if (key == "image_width") cam.image_width = int32_t(value);
+        else if (key == "samples_per_pixel") cam.samples_per_pixel = int32_t(value);
+        else if (key == "max_depth") cam.max_depth = int32_t(value);
+        else throw parse_error(path, text, line, "unknown keyword '" + std::string(key) + "'");
+    } else {
+        throw parse_error(path, text, line, "unknown keyword '" + std::string(key) + "'");
+    }
+
+    if (!ok || !in.at_end())
+        throw parse_error(path, text, line, "malformed '" + std::string(key) + "' line");
+}
+
+inline bool finite_sphere(const sphere_desc& d) {
+    return std::isfinite(d.center[0]) && std::isfinite(d.center[1]) && std::isfinite(d.center[2]) && std::isfinite(d.radius);
+}
+
+inline bool is_sphere_line(const char* line, const char* line_end) {
+    return line_end - line > 7 && std::memcmp(line, "sphere", 6) == 0 && (line[6] == ' ' || line[6] == '\t');
+}
+
+inline const char* skip_line_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+// parses the text form. the file is split into one chunk per thread at line boundaries; a first
+// pass counts the sphere lines of every chunk and collects the other lines, which are applied in
+// file order so the material names are known, then a second pass parses every chunk's spheres
+// straight into their final slots of sink
+template <typename sphere_sink>
+scene_description parse_scene_text(const std::string& path, const char* text, size_t length, sphere_sink& sink) {
+    const char* text_end = text + length;
+
+    int chunks = loader_threads(length / 32);
+    std::vector<const char*> bounds(chunks + 1);
+    bounds[0] = text;
+    bounds[chunks] = text_end;
+    for (int c = 1; c < chunks; c++) {
+        const char* p = text + length * c / chunks;
+        p = std::max(p, bounds[c - 1]);
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', size_t(text_end - p)));
+        bounds[c] = nl ? nl + 1 : text_end;
+    }
+
+    auto for_each_line = [&](int c, auto&& fn) {
+        for (const char* p = bounds[c]; p < bounds[c + 1];) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', size_t(bounds[c + 1] - p)));
+            const char* line_end = nl ? nl : bounds[c + 1];
+            const char* line = skip_line_space(p, line_end);
+            if (line < line_end && *line != '#')
+                fn(line, line_end);
+            p = line_end + 1;
+        }
+    };
+
+    std::vector<size_t> sphere_counts(chunks + 1, 0);
+    std::vector<std::vector<std::pair<const char*, const char*>>> directives(chunks);
+    parallel_chunks(size_t(chunks), chunks, [&](int c, size_t, size_t) {
+        for_each_line(c, [&](const char* line, const char* line_end) {
+            if (is_sphere_line(line, line_end))
+                sphere_counts[c + 1]++;
+            else
+                directives[c].emplace_back(line, line_end);
+        });
+    });
+
+    scene_description desc;
+    for (int c = 0; c < chunks; c++)
+        for (const auto& d : directives[c])
+            parse_directive(path, text, d.first, d.second, desc);
+    desc.camera.validate(path);
+
+    std::unordered_map<std::string_view, uint32_t> material_index;
+    for (size_t m = 0; m < desc.material_names.size(); m++)
+        if (!material_index.emplace(desc.material_names[m], uint32_t(m)).second)
+            throw std::runtime_error(path + ": material '" + desc.material_names[m] + "' declared twice");
+
+    for (size_t k = 0; k < desc.meshes.size(); k++) {
+        auto found = material_index.find(desc.mesh_material_names[k]);
+        if (found == material_index.end())
+            throw std::runtime_error(path + ": mesh " + desc.meshes[k].path + " uses unknown material '" + desc.mesh_material_names[k] + "'");
+        desc.meshes[k].material = found->second;
+    }
+
+    for (int c = 0; c < chunks; c++)
+        sphere_counts[c + 1] += sphere_counts[c];
+    sink.begin(desc, sphere_counts[chunks]);
+
+    parallel_chunks(size_t(chunks), chunks, [&](int c, size_t, size_t) {
+        size_t next = sphere_counts[c];
+        // neighbouring spheres tend to share a material, so the last lookup is usually reused
+        std::string_view last_name;
+        uint32_t last_index = 0;
+        for_each_line(c, [&](const char* line, const char* line_end) {
+            if (!is_sphere_line(line, line_end))
+                return;
+            line_reader in(line + 6, line_end);
+            sphere_desc s;
+            std::string_view name;
+            if (!(in.number(s.center[0]) && in.number(s.center[1]) && in.number(s.center[2])
+                  && in.number(s.radius) && in.word(name) && in.at_end()))
+                throw parse_error(path, text, line, "malformed 'sphere' line");
+            if (!finite_sphere(s))
+                throw parse_error(path, text, line, "sphere center and radius must be finite numbers");
+            if (name != last_name) {
+                auto found = material_index.find(name);
+                if (found == material_index.end())
+                    throw parse_error(path, text, line, "unknown material '" + std::string(name) + "'");
+                last_name = name;
+                last_index = found->second;
+            }
+            s.material = last_index;
+            s.reserved = 0;
+            sink.set(next++, s);
+        });
+    });
+
+    return desc;
+}
+
+inline void write_scene_binary(const std::string& path, const scene_description& desc) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("cannot write scene file: " + path);
+
+    scene_file_header header{};
+    std::memcpy(header.magic, scene_file_magic, sizeof(header.magic));
+    header.material_count = uint32_t(desc.materials.size());
+    header.mesh_count = uint32_t(desc.meshes.size());
+    header.sphere_count = desc.spheres.size();
+    header.camera = desc.camera;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(desc.materials.data()), std::streamsize(desc.materials.size() * sizeof(material_desc)));
+    out.write(reinterpret_cast<const char*>(desc.spheres.data()), std::streamsize(desc.spheres.size() * sizeof(sphere_desc)));
+    for (const auto& m : desc.meshes) {
+        uint32_t record[2] = {m.material, uint32_t(m.path.size())};
+        out.write(reinterpret_cast<const char*>(record), sizeof(record));
+        out.write(m.path.data(), std::streamsize(m.path.size()));
+    }
+    if (!out)
+        throw std::runtime_error("cannot write scene file: " + path);
+}
+
+// the scene's materials made from their records, indexed like the records
+inline std::vector<const material*> make_materials(scene& s, const material_desc* materials, size_t material_count) {
+    std::vector<const material*> table(material_count);
+    for (size_t m = 0; m < material_count; m++) {
+        const double* v = materials[m].params;
+        if (!std::all_of(v, v + 4, [](double p) { return std::isfinite(p); }))
+            throw std::runtime_error(s.name + ": material " + std::to_string(m) + " has values that are not finite numbers");
+        switch (materials[m].type) {
+            case material_type::lambertian: table[m] = s.materials.add(lambertian(color(v[0], v[1], v[2]))); break;
+            case material_type::metal: table[m] = s.materials.add(metal(color(v[0], v[1], v[2]), v[3])); break;
+            case material_type::dielectric: table[m] = s.materials.add(dielectric(v[0])); break;
+            case material_type::diffuse_light: table[m] = s.materials.add(diffuse_light(color(v[0], v[1], v[2]))); break;
+            default: throw std::runtime_error(s.name + ": material " + std::to_string(m) + " has an unknown kind");
+        }
+    }
+    return table;
+}
+
+// places the parsed spheres of a text scene straight into the staging arrays of the scene's sphere_set
+struct scene_spheres {
+    scene& s;
+    sphere_set& spheres;
+    std::vector<const material*> table;
+    size_t first = 0;
+
+    void begin(scene_description& desc, size_t count) {
+        table = make_materials(s, desc.materials.data(), desc.materials.size());
+        first = spheres.extend(count);
+    }
+    void set(size_t index, const sphere_desc& d) {
+        spheres.set(first + index, point3(d.center[0], d.center[1], d.center[2]), d.radius, table[d.material]);
+    }
+};
+
+// finishes a scene whose sphere_set holds every sphere: emissive spheres are also kept on their
+// own for light sampling, the set's tree is built on the loader's threads and every mesh is
+// loaded with its own tree
+inline void finish_scene(scene& s, const shared_ptr<sphere_set>& spheres, const std::vector<const material*>& table,
+                         const std::vector<mesh_desc>& meshes) {
+    if (std::any_of(table.begin(), table.end(), [](const material* m) { return m->emits(); }))
+        spheres->add_emitters(s.cam.lights);
+
+    size_t sphere_count = spheres->staged_size();
+    if (sphere_count > 0) {
+        spheres->build(s.storage, loader_threads(sphere_count));
+        s.primitives = spheres->size();
+        s.world.add(spheres);
+    }
+
+    auto base_dir = std::filesystem::path(s.name).parent_path();
+    for (const auto& m : meshes) {
+        if (m.material >= table.size())
+            throw std::runtime_error(s.name + ": mesh " + m.path + " refers to a material that does not exist");
+        auto mesh = load_obj((base_dir / m.path).string(), table[m.material]);
+        s.primitives += mesh->triangle_count();
+        if (table[m.material]->emits()) {
+            mesh->prepare_light_sampling();
+            s.cam.lights.add(mesh);
+        }
+        s.world.add(mesh);
+    }
+}
+
+inline bool is_binary_scene(const mapped_file& file) {
+    return file.size() >= sizeof(scene_file_magic) && std::memcmp(file.data(), scene_file_magic, sizeof(scene_file_magic)) == 0;
+}
+
+inline scene_description read_scene_text(const std::string& path) {
+    mapped_file file(path);
+    description_spheres spheres;
+    return parse_scene_text(path, file.data(), file.size(), spheres);
+}
+
+// loads either form, telling them apart by the binary magic
+inline scene load_scene(const std::string& path) {
+    RT_SCOPE("load scene");
+    mapped_file file(path);
+
+    if (file.size() >= sizeof(scene_file_magic_v1) && std::memcmp(file.data(), scene_file_magic_v1, sizeof(scene_file_magic_v1)) == 0)
+        throw std::runtime_error(path + ": binary scene from an older version, convert its text scene again");
+    scene s;
+    s.name = path;
+    auto spheres = make_shared<sphere_set>();
+    if (!is_binary_scene(file)) {
+        scene_spheres sink{s, *spheres, {}, 0};
+        scene_description desc = parse_scene_text(path, file.data(), file.size(), sink);
+        desc.camera.apply(s.cam);
+        finish_scene(s, spheres, sink.table, desc.meshes);
+        return s;
+    }
+
+    if (file.size() < sizeof(scene_file_header))
+        throw std::runtime_error(path + ": truncated scene header");
+    scene_file_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    // every count is checked against the bytes left before it is multiplied, so a corrupt
+    // header cannot wrap the sizes around and pass
+    size_t remaining = file.size() - sizeof(header);
+    if (header.material_count > remaining / sizeof(material_desc))
+        throw std::runtime_error(path + ": scene file is shorter than its header says");
+    remaining -= size_t(header.material_count) * sizeof(material_desc);
+    if (header.sphere_count > remaining / sizeof(sphere_desc))
+        throw std::runtime_error(path + ": scene file is shorter than its header says");
+    remaining -= size_t(header.sphere_count) * sizeof(sphere_desc);
+    if (header.mesh_count > remaining / (2 * sizeof(uint32_t)))
+        throw std::runtime_error(path + ": truncated mesh list");
+    size_t records_end = file.size() - remaining;
+
+    // the header size is a multiple of 8, so both arrays are suitably aligned in the mapping
+    const auto* materials = reinterpret_cast<const material_desc*>(file.data() + sizeof(header));
+    const auto* records = reinterpret_cast<const sphere_desc*>(materials + header.material_count);
+
+    std::vector<mesh_desc> meshes(header.mesh_count);
+    size_t offset = records_end;
+    for (auto& m : meshes) {
+        uint32_t record[2];
+        if (file.size() - offset < sizeof(record))
+            throw std::runtime_error(path + ": truncated mesh list");
+        std::memcpy(record, file.data() + offset, sizeof(record));
+        offset += sizeof(record);
+        if (file.size() - offset < record[1])
+            throw std::runtime_error(path + ": truncated mesh list");
+        m.material = record[0];
+        m.path.assign(file.data() + offset, record[1]);
+        offset += record[1];
+    }
+    if (offset != file.size())
+        throw std::runtime_error(path + ": scene file size does not match its header");
+
+    header.camera.validate(path);
+    header.camera.apply(s.cam);
+    auto table = make_materials(s, materials, header.material_count);
+
+    // the count is known from the header, so the records go straight into the staging arrays
+    size_t sphere_count = size_t(header.sphere_count);
+    size_t first = spheres->extend(sphere_count);
+    std::atomic<bool> bad_material{false}, bad_value{false};
+    parallel_chunks(sphere_count, loader_threads(sphere_count), [&](int, size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            const sphere_desc& d = records[k];
+            if (d.material >= header.material_count) {
+                bad_material = true;
+                return;
+            }
+            if (!finite_sphere(d)) {
+                bad_value = true;
+                return;
+            }
+            spheres->set(first + k, point3(d.center[0], d.center[1], d.center[2]), d.radius, table[d.material]);
+        }
+    });
+    if (bad_material)
+        throw std::runtime_error(path + ": sphere refers to a material that does not exist");
+    if (bad_value)
+        throw std::runtime_error(path + ": sphere center and radius must be finite numbers");
+
+    finish_scene(s, spheres, table, meshes);
+    return s;
+}
+
+#endif
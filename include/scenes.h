@@ -0,0 +1,318 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "constants.h"
+#include "hittable_list.h"
+#include "sphere_set.h"
+#include "material.h"
+#include "camera.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+
+#include <string>
+
+// a world together with the camera set up to look at it
+struct scene {
+    std::string name;
+    arena storage;            // primitive data laid out by build, declared first so it outlives the world
+    material_table materials; // the world points into this table, so a scene is moved, never copied
+    hittable_list world;
+    camera cam;
+    size_t primitives = 0;
+};
+
+// the final scene of the book: a large glass, diffuse and metal sphere among ~480 small random ones
+inline scene random_spheres_scene(uint64_t seed = 0) {
+    seed_thread_rng(seed);
+
+    scene s;
+    s.name = "random_spheres";
+    auto spheres = make_shared<sphere_set>();
+
+    auto ground_material = s.materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    spheres->add(point3(0,-1000,0), 1000, ground_material);
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                const material* sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = s.materials.add(lambertian(albedo));
+                    spheres->add(center, 0.2, sphere_material);
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = s.materials.add(metal(albedo, fuzz));
+                    spheres->add(center, 0.2, sphere_material);
+                } else {
+                    // glass
+                    sphere_material = s.materials.add(dielectric(1.5));
+                    spheres->add(center, 0.2, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = s.materials.add(dielectric(1.5));
+    spheres->add(point3(0, 1, 0), 1.0, material1);
+
+    auto material2 = s.materials.add(lambertian(color(0.4, 0.2, 0.1)));
+    spheres->add(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = s.materials.add(metal(color(0.7, 0.6, 0.5), 0.0));
+    spheres->add(point3(4, 1, 0), 1.0, material3);
+
+    spheres->build(s.storage);
+    s.primitives = spheres->size();
+    s.world.add(spheres);
+
+    camera& cam = s.cam;
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 500;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 10.0;
+
+    return s;
+}
+
+// count small spheres scattered over a wide ground plane, for acceleration structure scaling
+inline scene dense_field_scene(int count = 100000, uint64_t seed = 0) {
+    seed_thread_rng(seed);
+
+    scene s;
+    s.name = "dense_field";
+    auto spheres = make_shared<sphere_set>();
+
+    spheres->add(point3(0,-1000,0), 1000, s.materials.add(lambertian(color(0.5, 0.5, 0.5))));
+
+    // a few hundred materials shared by all spheres, like a real scene's material library
+    std::vector<const material*> palette;
+    for (int m = 0; m < 256; m++) {
+        auto choose_mat = random_double();
+        if (choose_mat < 0.8)
+            palette.push_back(s.materials.add(lambertian(color::random() * color::random())));
+        else if (choose_mat < 0.95)
+            palette.push_back(s.materials.add(metal(color::random(0.5, 1), random_double(0, 0.5))));
+        else
+            palette.push_back(s.materials.add(dielectric(1.5)));
+    }
+
+    double extent = std::sqrt(double(count)) * 0.5;
+    for (int k = 0; k < count; k++) {
+        auto radius = random_double(0.05, 0.25);
+        point3 center(random_double(-extent, extent), radius + random_double(0, 2), random_double(-extent, extent));
+        spheres->add(center, radius, palette[int(random_double() * palette.size())]);
+    }
+
+    spheres->build(s.storage);
+    s.primitives = spheres->size();
+    s.world.add(spheres);
+
+    camera& cam = s.cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width  = 400;
+    cam.vfov         = 40;
+    cam.lookfrom     = point3(extent, 6, extent);
+    cam.lookat       = point3(0, 0, 0);
+    cam.vup          = vec3(0,1,0);
+    cam.focus_dist   = (cam.lookfrom - cam.lookat).length();
+
+    return s;
+}
+
+// mostly dielectric spheres, whose long refraction paths stress the integrator rather than traversal
+inline scene glass_scene(uint64_t seed = 0) {
+    seed_thread_rng(seed);
+
+    scene s;
+    s.name = "glass";
+    auto spheres = make_shared<sphere_set>();
+
+    spheres->add(point3(0,-1000,0), 1000, s.materials.add(lambertian(color(0.6, 0.6, 0.6))));
+
+    auto glass = s.materials.add(dielectric(1.5));
+    auto bubble = s.materials.add(dielectric(1.0 / 1.5));
+    for (int a = -6; a < 6; a++) {
+        for (int b = -6; b < 6; b++) {
+            auto radius = random_double(0.2, 0.45);
+            point3 center(a + 0.5 + 0.2*random_double(), radius, b + 0.5 + 0.2*random_double());
+            spheres->add(center, radius, glass);
+            if (random_double() < 0.3)
+                spheres->add(center, radius * 0.8, bubble); // hollow glass
+        }
+    }
+    spheres->add(point3(0, 1.5, 0), 1.5, glass);
+    spheres->add(point3(0, 1.5, 0), 1.3, bubble);
+
+    spheres->build(s.storage);
+    s.primitives = spheres->size();
+    s.world.add(spheres);
+
+    camera& cam = s.cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width  = 400;
+    cam.vfov         = 30;
+    cam.lookfrom     = point3(10, 4, 8);
+    cam.lookat       = point3(0, 0.8, 0);
+    cam.vup          = vec3(0,1,0);
+    cam.focus_dist   = (cam.lookfrom - cam.lookat).length();
+
+    return s;
+}
+
+// spheres on a ground lit only by two small sphere lights and a square panel overhead, against
+// a black background. without light sampling almost every path misses the lights, which makes
+// this the scene where next-event estimation matters
+inline scene lights_scene(uint64_t seed = 0) {
+    seed_thread_rng(seed);
+
+    scene s;
+    s.name = "lights";
+    auto spheres = make_shared<sphere_set>();
+
+    spheres->add(point3(0,-1000,0), 1000, s.materials.add(lambertian(color(0.5, 0.5, 0.5))));
+    spheres->add(point3(-2.2, 1, 0), 1, s.materials.add(lambertian(color(0.7, 0.3, 0.2))));
+    spheres->add(point3(0, 1, 0), 1, s.materials.add(dielectric(1.5)));
+    spheres->add(point3(2.2, 1, 0), 1, s.materials.add(metal(color(0.8, 0.8, 0.7), 0.1)));
+    for (int k = 0; k < 40; k++) {
+        point3 center(random_double(-6, 6), 0.25, random_double(-4, 3));
+        if (std::fabs(center.z()) < 1.4 && std::fabs(center.x()) < 3.4) continue;
+        spheres->add(center, 0.25, s.materials.add(lambertian(color::random() * color::random())));
+    }
+
+    // the small lights are in the sphere set for intersection and in cam.lights for sampling
+    const point3 bulbs[2] = {point3(-3, 2.6, 2), point3(3.5, 0.6, 1.8)};
+    auto warm = s.materials.add(diffuse_light(color(40, 30, 18)));
+    for (const auto& center : bulbs) {
+        spheres->add(center, 0.15, warm);
+        s.cam.lights.add(make_shared<sphere>(center, 0.15, warm));
+    }
+
+    spheres->build(s.storage);
+    s.world.add(spheres);
+
+    auto panel = make_shared<triangle_mesh>(s.materials.add(diffuse_light(color(4, 4, 4))));
+    uint32_t c0 = panel->add_vertex(point3(-1, 5, -1)), c1 = panel->add_vertex(point3(1, 5, -1));
+    uint32_t c2 = panel->add_vertex(point3(1, 5, 1)), c3 = panel->add_vertex(point3(-1, 5, 1));
+    panel->add_triangle(c0, c1, c2); // facing down
+    panel->add_triangle(c0, c2, c3);
+    panel->build();
+    panel->prepare_light_sampling();
+    s.world.add(panel);
+    s.cam.lights.add(panel);
+    s.primitives = spheres->size() + panel->triangle_count();
+
+    camera& cam = s.cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width  = 400;
+    cam.vfov         = 35;
+    cam.lookfrom     = point3(0, 3, 11);
+    cam.lookat       = point3(0, 1, 0);
+    cam.vup          = vec3(0,1,0);
+    cam.focus_dist   = (cam.lookfrom - cam.lookat).length();
+    cam.sky          = false;
+
+    return s;
+}
+
+// a fir: a trunk cylinder under three stacked cones, segments triangles around, in a unit-high box
+inline shared_ptr<triangle_mesh> make_fir_mesh(const material* mat, int segments = 24) {
+    auto mesh = make_shared<triangle_mesh>(mat);
+    auto ring = [&](double y, double radius) {
+        uint32_t first = uint32_t(mesh->vertex_count());
+        for (int k = 0; k < segments; k++) {
+            double angle = 2 * pi * k / segments;
+            mesh->add_vertex(point3(radius * std::cos(angle), y, radius * std::sin(angle)));
+        }
+        return first;
+    };
+
+    // trunk: open cylinder
+    uint32_t bottom = ring(0, 0.04), top = ring(0.3, 0.04);
+    for (int k = 0; k < segments; k++) {
+        uint32_t next = uint32_t((k + 1) % segments);
+        mesh->add_triangle(bottom + k, bottom + next, top + next);
+        mesh->add_triangle(bottom + k, top + next, top + k);
+    }
+
+    // canopy: each cone closed by a fan underneath
+    const double cones[3][3] = {{0.2, 0.6, 0.3}, {0.45, 0.8, 0.24}, {0.65, 1.0, 0.16}}; // base y, apex y, radius
+    for (const auto& c : cones) {
+        uint32_t base = ring(c[0], c[2]);
+        uint32_t apex = mesh->add_vertex(point3(0, c[1], 0));
+        uint32_t center = mesh->add_vertex(point3(0, c[0], 0));
+        for (int k = 0; k < segments; k++) {
+            uint32_t next = uint32_t((k + 1) % segments);
+            mesh->add_triangle(base + k, apex, base + next);
+            mesh->add_triangle(base + k, base + next, center);
+        }
+    }
+
+    mesh->build();
+    return mesh;
+}
+
+// count firs placed with random height, girth and rotation over a square of ground, all
+// instances of two prototype meshes (a full and a sparse fir) shaded from a small palette
+inline scene forest_scene(int count = 1000000, uint64_t seed = 0) {
+    seed_thread_rng(seed);
+
+    scene s;
+    s.name = "forest";
+
+    auto ground = make_shared<sphere_set>();
+    ground->add(point3(0,-10000,0), 10000, s.materials.add(lambertian(color(0.35, 0.3, 0.2))));
+    ground->build(s.storage);
+    s.world.add(ground);
+
+    const material* greens[4] = {
+        s.materials.add(lambertian(color(0.1, 0.3, 0.1))),
+        s.materials.add(lambertian(color(0.15, 0.35, 0.12))),
+        s.materials.add(lambertian(color(0.08, 0.22, 0.1))),
+        s.materials.add(lambertian(color(0.2, 0.3, 0.1))),
+    };
+    shared_ptr<hittable> prototypes[2] = { make_fir_mesh(greens[0], 24), make_fir_mesh(greens[0], 8) };
+
+    auto forest = make_shared<instance_set>();
+    double extent = std::sqrt(double(count)) * 1.5;
+    for (int k = 0; k < count; k++) {
+        double height = random_double(2, 5);
+        double girth = height * random_double(0.8, 1.2);
+        point3 base(random_double(-extent, extent), 0, random_double(-extent, extent));
+        transform placement = transform::translate(base)
+                            * transform::rotate(vec3(0,1,0), random_double(0, 360))
+                            * transform::scale(vec3(girth, height, girth));
+        forest->add(prototypes[int(random_double() * 2)], placement, greens[int(random_double() * 4)]);
+    }
+    forest->build();
+    s.primitives = forest->size();
+    s.world.add(forest);
+
+    camera& cam = s.cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width  = 400;
+    cam.vfov         = 50;
+    cam.lookfrom     = point3(0, 12, 0);
+    cam.lookat       = point3(40, 2, 40);
+    cam.vup          = vec3(0,1,0);
+    cam.focus_dist   = (cam.lookfrom - cam.lookat).length();
+
+    return s;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "constants.h"
+
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// thin wrappers over the widest vector registers the build targets, holding reals: 8 doubles
+// or 16 floats with AVX-512, 4 doubles or 8 floats with AVX. kernels are written once against
+// these and compile to plain intrinsics. RT_HAVE_SIMD is left undefined without AVX, and
+// kernels keep a scalar loop for that case
+#if defined(__AVX512F__)
+#define RT_HAVE_SIMD 1
+#ifdef RT_USE_FLOAT
+constexpr int simd_lanes = 16;
+using real_vec = __m512;
+using real_mask = __mmask16;
+inline real_vec vsplat(real x) { return _mm512_set1_ps(x); }
+inline real_vec vload(const real* p) { return _mm512_load_ps(p); }
+inline void vstore(real* p, real_vec a) { _mm512_store_ps(p, a); }
+inline real_vec vadd(real_vec a, real_vec b) { return _mm512_add_ps(a, b); }
+inline real_vec vsub(real_vec a, real_vec b) { return _mm512_sub_ps(a, b); }
+inline real_vec vmul(real_vec a, real_vec b) { return _mm512_mul_ps(a, b); }
+inline real_vec vdiv(real_vec a, real_vec b) { return _mm512_div_ps(a, b); }
+inline real_vec vsqrt(real_vec a) { return _mm512_sqrt_ps(a); }
+inline real_mask vgt(real_vec a, real_vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+inline real_mask vlt(real_vec a, real_vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline real_mask vge(real_vec a, real_vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+inline real_vec vselect(real_mask m, real_vec a, real_vec b) { return _mm512_mask_blend_ps(m, b, a); }
+#else
+constexpr int simd_lanes = 8;
+using real_vec = __m512d;
+using real_mask = __mmask8;
+inline real_vec vsplat(real x) { return _mm512_set1_pd(x); }
+inline real_vec vload(const real* p) { return _mm512_load_pd(p); }
+inline void vstore(real* p, real_vec a) { _mm512_store_pd(p, a); }
+inline real_vec vadd(real_vec a, real_vec b) { return _mm512_add_pd(a, b); }
+inline real_vec vsub(real_vec a, real_vec b) { return _mm512_sub_pd(a, b); }
+inline real_vec vmul(real_vec a, real_vec b) { return _mm512_mul_pd(a, b); }
+inline real_vec vdiv(real_vec a, real_vec b) { return _mm512_div_pd(a, b); }
+inline real_vec vsqrt(real_vec a) { return _mm512_sqrt_pd(a); }
+inline real_mask vgt(real_vec a, real_vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+inline real_mask vlt(real_vec a, real_vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+inline real_mask vge(real_vec a, real_vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+inline real_vec vselect(real_mask m, real_vec a, real_vec b) { return _mm512_mask_blend_pd(m, b, a); }
+#endif
+// AVX-512 compares produce bit masks directly
+inline real_mask mask_and(real_mask a, real_mask b) { return real_mask(a & b); }
+inline real_mask mask_or(real_mask a, real_mask b) { return real_mask(a | b); }
+inline real_mask mask_andnot(real_mask a, real_mask b) { return real_mask(~a & b); }
+inline unsigned mask_bits(real_mask m) { return unsigned(m); }
+inline real_mask mask_first(int count) { return real_mask((1u << count) - 1); }
+
+#elif defined(__AVX__)
+#define RT_HAVE_SIMD 1
+#ifdef RT_USE_FLOAT
+constexpr int simd_lanes = 8;
+using real_vec = __m256;
+using real_mask = __m256;
+inline real_vec vsplat(real x) { return _mm256_set1_ps(x); }
+inline real_vec vload(const real* p) { return _mm256_load_ps(p); }
+inline void vstore(real* p, real_vec a) { _mm256_store_ps(p, a); }
+inline real_vec vadd(real_vec a, real_vec b) { return _mm256_add_ps(a, b); }
+inline real_vec vsub(real_vec a, real_vec b) { return _mm256_sub_ps(a, b); }
+inline real_vec vmul(real_vec a, real_vec b) { return _mm256_mul_ps(a, b); }
+inline real_vec vdiv(real_vec a, real_vec b) { return _mm256_div_ps(a, b); }
+inline real_vec vsqrt(real_vec a) { return _mm256_sqrt_ps(a); }
+inline real_mask vgt(real_vec a, real_vec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline real_mask vlt(real_vec a, real_vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline real_mask vge(real_vec a, real_vec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline real_vec vselect(real_mask m, real_vec a, real_vec b) { return _mm256_blendv_ps(b, a, m); }
+inline real_mask mask_and(real_mask a, real_mask b) { return _mm256_and_ps(a, b); }
+inline real_mask mask_or(real_mask a, real_mask b) { return _mm256_or_ps(a, b); }
+inline real_mask mask_andnot(real_mask a, real_mask b) { return _mm256_andnot_ps(a, b); }
+inline unsigned mask_bits(real_mask m) { return unsigned(_mm256_movemask_ps(m)); }
+inline real_mask mask_first(int count) {
+    return _mm256_cmp_ps(_mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0), _mm256_set1_ps(real(count)), _CMP_LT_OQ);
+}
+#else
+constexpr int simd_lanes = 4;
+using real_vec = __m256d;
+using real_mask = __m256d;
+inline real_vec vsplat(real x) { return _mm256_set1_pd(x); }
+inline real_vec vload(const real* p) { return _mm256_load_pd(p); }
+inline void vstore(real* p, real_vec a) { _mm256_store_pd(p, a); }
+inline real_vec vadd(real_vec a, real_vec b) { return _mm256_add_pd(a, b); }
+inline real_vec vsub(real_vec a, real_vec b) { return _mm256_sub_pd(a, b); }
+inline real_vec vmul(real_vec a, real_vec b) { return _mm256_mul_pd(a, b); }
+inline real_vec vdiv(real_vec a, real_vec b) { return _mm256_div_pd(a, b); }
+inline real_vec vsqrt(real_vec a) { return _mm256_sqrt_pd(a); }
+inline real_mask vgt(real_vec a, real_vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+inline real_mask vlt(real_vec a, real_vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline real_mask vge(real_vec a, real_vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+inline real_vec vselect(real_mask m, real_vec a, real_vec b) { return _mm256_blendv_pd(b, a, m); }
+inline real_mask mask_and(real_mask a, real_mask b) { return _mm256_and_pd(a, b); }
+inline real_mask mask_or(real_mask a, real_mask b) { return _mm256_or_pd(a, b); }
+inline real_mask mask_andnot(real_mask a, real_mask b) { return _mm256_andnot_pd(a, b); }
+inline unsigned mask_bits(real_mask m) { return unsigned(_mm256_movemask_pd(m)); }
+inline real_mask mask_first(int count) {
+    return _mm256_cmp_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(count), _CMP_LT_OQ);
+}
+#endif
+
+#else
+constexpr int simd_lanes = 4; // block width of the scalar fallbacks
+#endif
+
+#endif
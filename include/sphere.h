@@ -3,13 +3,29 @@
 
 #include "hittable.h"
 #include "constants.h"
+#include "pdf.h"
+
+// moves a computed hit point p onto the sphere along the ray from the center. the distance
+// root is the least accurate step of a sphere hit; after this the point is off by only a few
+// roundings of its offset from the center, which is what error is set to
+inline point3 refine_sphere_point(const point3& p, const point3& center, real radius, real& error) {
+    vec3 offset = p - center;
+    offset *= radius / offset.length();
+    point3 refined = center + offset;
+    error = rounding_gamma(5) * max_abs(offset) + rounding_gamma(1) * max_abs(refined);
+    return refined;
+}
 
 class sphere: public hittable {
     public:
-        sphere(const point3& center, double radius, shared_ptr<material> mat) 
-            : center(center), radius(std::fmax(0,radius)), mat(mat) {}
+        sphere(const point3& center, real radius, const material* mat) 
+            : center(center), radius(std::fmax(0,radius)), mat(mat) {
+            auto rvec = vec3(radius, radius, radius);
+            bbox = aabb(center - rvec, center + rvec);
+        }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_COUNT(primitive_tests);
             vec3 oc = center - r.origin();
             auto a = r.direction().length_squared();
             auto h = dot(r.direction(), oc);
@@ -30,7 +46,7 @@ class sphere: public hittable {
             }
 
             rec.t = root;
-            rec.p = r.at(rec.t);
+            rec.p = refine_sphere_point(r.at(rec.t), center, radius, rec.error);
 
             // rec.normal = (rec.p - center) / radius; 
             vec3 outward_normal = (rec.p - center) / radius;
@@ -40,10 +56,36 @@ class sphere: public hittable {
             return true;
         }
 
+        aabb bounding_box() const override { return bbox; }
+
+        // directions are drawn uniformly from the cone the sphere subtends from origin, so a
+        // small or distant light is sampled no worse than a large one. from inside the sphere
+        // there is no cone and the light is not sampled
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            double distance_squared = (center - origin).length_squared();
+            if (distance_squared <= double(radius) * radius)
+                return 0.0;
+            hit_record rec;
+            if (!hit(ray(origin, direction), interval(0, infinity), rec))
+                return 0.0;
+            double cos_theta_max = std::sqrt(1 - double(radius) * radius / distance_squared);
+            return 1 / (2 * pi * (1 - cos_theta_max));
+        }
+
+        vec3 random(const point3& origin, const sample2& u) const override {
+            vec3 direction = center - origin;
+            double distance_squared = direction.length_squared();
+            if (distance_squared <= double(radius) * radius)
+                return direction;
+            onb uvw(direction);
+            return uvw.transform(random_to_sphere(radius, distance_squared, u));
+        }
+
     private:
         point3 center;
-        double radius; 
-        shared_ptr<material> mat;
+        real radius; 
+        const material* mat;
+        aabb bbox;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,344 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "sphere.h"
+#include "material.h"
+#include "arena.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// number of spheres tested against one ray per instruction: 8 doubles or 16 floats with
+// AVX-512, 4 doubles or 8 floats with AVX
+constexpr int sphere_lanes = simd_lanes;
+
+// many spheres stored as structure-of-arrays and intersected sphere_lanes at a time.
+// a bvh_tree is built over the spheres with leaves of at most sphere_lanes spheres, and every
+// leaf is laid out as one aligned block so a single SIMD pass tests the whole leaf.
+// build places the blocks, and copies of the materials they use in the order traversal meets
+// them, in one stretch of the scene's arena, so the set must not outlive that arena. until then
+// the added spheres wait in structure-of-arrays staging arrays of the set's own arena, which
+// loaders that know their sphere count fill in place, and which build releases.
+// hit_record is only filled for the closest sphere once traversal is done, and produces the same
+// record sphere::hit would
+class sphere_set : public hittable {
+    public:
+        void add(const point3& center, real radius, const material* mat) {
+            set(extend(1), center, radius, mat);
+        }
+
+        // makes room for count more spheres and returns the index of the first. the new slots are
+        // filled with set, from several threads if need be, before build
+        size_t extend(size_t count) {
+            size_t first = staged_count;
+            // at least doubles the room, so adding one sphere at a time copies each only a few times
+            if (first + count > staged_capacity)
+                grow_staging(std::max({first + count, 2 * staged_capacity, size_t(64)}));
+            staged_count += count;
+            return first;
+        }
+
+        void set(size_t index, const point3& center, real radius, const material* mat) {
+            staged_x[index] = center.x();
+            staged_y[index] = center.y();
+            staged_z[index] = center.z();
+            staged_radii[index] = std::fmax(0, radius);
+            staged_mats[index] = mat;
+        }
+
+        size_t size() const { return sphere_count; }
+        size_t staged_size() const { return staged_count; }
+
+        // adds the spheres made of an emitting material to lights as spheres of their own, for
+        // light sampling; must be called before build
+        void add_emitters(hittable_list& lights) const {
+            for (size_t i = 0; i < staged_count; i++)
+                if (staged_mats[i]->emits())
+                    lights.add(make_shared<sphere>(point3(staged_x[i], staged_y[i], staged_z[i]), staged_radii[i], staged_mats[i]));
+        }
+
+        // lays the added spheres out in leaf order in storage, using up to `threads` threads;
+        // must be called before the set is hit
+        void build(arena& storage, int threads = 1) {
+            threads = std::max(1, threads);
+            std::vector<aabb> boxes(staged_count);
+            parallel_chunks(staged_count, threads, [&](int, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    auto center = point3(staged_x[i], staged_y[i], staged_z[i]);
+                    auto rvec = vec3(staged_radii[i], staged_radii[i], staged_radii[i]);
+                    boxes[i] = aabb(center - rvec, center + rvec);
+                }
+            });
+
+            tree.build(boxes, sphere_lanes, sphere_lanes, threads);
+            boxes.clear();
+            boxes.shrink_to_fit();
+
+            // one lane-aligned block per leaf, leaf offsets are rewritten to point at their block.
+            // materials are numbered in the order the blocks first use them
+            std::vector<int> leaves;
+            for (int n = 0; n < int(tree.nodes.size()); n++)
+                if (tree.nodes[n].count > 0) leaves.push_back(n);
+            size_t slots = leaves.size() * sphere_lanes;
+
+            std::unordered_map<const material*, uint32_t> material_index;
+            std::vector<material> ordered_materials;
+            const material* last = nullptr;
+            for (int n : leaves) {
+                for (int k = 0; k < tree.nodes[n].count; k++) {
+                    // neighbouring spheres tend to share a material, so most lookups are skipped
+                    const material* m = staged_mats[tree.indices[tree.nodes[n].offset + k]];
+                    if (m != last && material_index.emplace(m, uint32_t(ordered_materials.size())).second)
+                        ordered_materials.push_back(*m);
+                    last = m;
+                }
+            }
+
+            storage.reserve(4 * (slots * sizeof(real) + cache_line_size) + slots * sizeof(uint32_t)
+                            + ordered_materials.size() * sizeof(material) + 2 * cache_line_size);
+            cx = storage.make_array<real>(slots, cache_line_size);
+            cy = storage.make_array<real>(slots, cache_line_size);
+            cz = storage.make_array<real>(slots, cache_line_size);
+            radius = storage.make_array<real>(slots, cache_line_size);
+            mat_index = storage.make_array<uint32_t>(slots, cache_line_size);
+            materials = storage.copy_array(ordered_materials.data(), ordered_materials.size(), cache_line_size);
+
+            // every leaf fills its own block, unused lanes included
+            parallel_chunks(leaves.size(), threads, [&](int, size_t begin, size_t end) {
+                const material* last = nullptr;
+                uint32_t last_index = 0;
+                for (size_t leaf = begin; leaf < end; leaf++) {
+                    bvh_tree::node& n = tree.nodes[leaves[leaf]];
+                    size_t slot = leaf * sphere_lanes;
+                    for (int k = 0; k < sphere_lanes; k++) {
+                        if (k >= n.count) {
+                            cx[slot + k] = cy[slot + k] = cz[slot + k] = radius[slot + k] = 0;
+                            mat_index[slot + k] = 0;
+                            continue;
+                        }
+                        int src = tree.indices[n.offset + k];
+                        cx[slot + k] = staged_x[src];
+                        cy[slot + k] = staged_y[src];
+                        cz[slot + k] = staged_z[src];
+                        radius[slot + k] = staged_radii[src];
+                        if (staged_mats[src] != last) {
+                            last = staged_mats[src];
+                            last_index = material_index.at(last);
+                        }
+                        mat_index[slot + k] = last_index;
+                    }
+                    n.offset = int(slot);
+                }
+            });
+
+            sphere_count = staged_count;
+            staging = arena();
+            staged_x = staged_y = staged_z = staged_radii = nullptr;
+            staged_mats = nullptr;
+            staged_count = staged_capacity = 0;
+            // assigning {} would only clear it; the indices are released for good
+            tree.indices.clear(); tree.indices.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            int closest = -1;
+            real closest_t = 0;
+            tree.traverse(r, ray_t, [&](int first, int count, interval& t) {
+                real block_t;
+                int lane = hit_block(r, first, count, t, block_t);
+                if (lane < 0) return false;
+                closest = first + lane;
+                closest_t = block_t;
+                t.max = block_t;
+                return true;
+            });
+
+            if (closest < 0) return false;
+            fill_record(r, closest, closest_t, rec);
+            return true;
+        }
+
+        // traverses the tree once for a packet of coherent rays, e.g. the primary rays of a tile.
+        // a node is entered when any ray of the packet still needs it
+        void hit_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const override {
+            const auto& nodes = tree.nodes;
+            arena& scratch = thread_scratch();
+            auto scratch_start = scratch.mark();
+            int* closest = scratch.make_array<int>(count);
+            real* closest_t = scratch.make_array<real>(count);
+            vec3* inv_dir = scratch.make_array<vec3>(count);
+            for (int k = 0; k < count; k++) {
+                closest[k] = -1;
+                closest_t[k] = ray_t.max;
+                const vec3& d = rays[k].direction();
+                inv_dir[k] = vec3(1 / d.x(), 1 / d.y(), 1 / d.z());
+            }
+
+            if (!nodes.empty() && count > 0) {
+                bool dir_is_neg[3] = { inv_dir[0].x() < 0, inv_dir[0].y() < 0, inv_dir[0].z() < 0 };
+                int stack[bvh_tree::max_depth];
+                int stack_size = 0;
+                int current = 0;
+
+                while (true) {
+                    const auto& n = nodes[current];
+                    RT_COUNT(node_visits);
+                    bool any = false;
+                    for (int k = 0; k < count && !any; k++)
+                        any = n.bbox.hit(rays[k].origin(), inv_dir[k], interval(ray_t.min, closest_t[k]));
+
+                    if (any && n.count > 0) {
+                        for (int k = 0; k < count; k++) {
+                            real t;
+                            int lane = hit_block(rays[k], n.offset, n.count, interval(ray_t.min, closest_t[k]), t);
+                            if (lane >= 0) {
+                                closest[k] = n.offset + lane;
+                                closest_t[k] = t;
+                            }
+                        }
+                    } else if (any) {
+                        bool far_first = dir_is_neg[n.axis];
+                        stack[stack_size++] = far_first ? current + 1 : n.offset;
+                        current = far_first ? n.offset : current + 1;
+                        continue;
+                    }
+
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+            }
+
+            for (int k = 0; k < count; k++) {
+                hits[k] = closest[k] >= 0;
+                if (hits[k])
+                    fill_record(rays[k], closest[k], closest_t[k], recs[k]);
+            }
+            scratch.rewind(scratch_start);
+        }
+
+        aabb bounding_box() const override { return tree.bounds(); }
+
+    private:
+        // leaf blocks in the scene arena, lane-aligned
+        real* cx = nullptr;
+        real* cy = nullptr;
+        real* cz = nullptr;
+        real* radius = nullptr;
+        uint32_t* mat_index = nullptr;   // into materials, half the size of a pointer per slot
+        const material* materials = nullptr;
+        bvh_tree tree;
+        size_t sphere_count = 0;
+
+        arena staging;
+        real* staged_x = nullptr;
+        real* staged_y = nullptr;
+        real* staged_z = nullptr;
+        real* staged_radii = nullptr;
+        const material** staged_mats = nullptr;
+        size_t staged_count = 0;
+        size_t staged_capacity = 0;
+
+        // moves the staged spheres to arrays with room for capacity of them, in a new arena
+        // that replaces the old one
+        void grow_staging(size_t capacity) {
+            arena grown;
+            grown.reserve(capacity * (4 * sizeof(real) + sizeof(const material*)) + 5 * cache_line_size);
+            auto move_over = [&](auto* old) {
+                using T = std::remove_pointer_t<decltype(old)>;
+                T* array = grown.make_array<T>(capacity, cache_line_size);
+                if (staged_count > 0) std::copy(old, old + staged_count, array);
+                return array;
+            };
+            staged_x = move_over(staged_x);
+            staged_y = move_over(staged_y);
+            staged_z = move_over(staged_z);
+            staged_radii = move_over(staged_radii);
+            staged_mats = move_over(staged_mats);
+            staging = std::move(grown);
+            staged_capacity = capacity;
+        }
+
+        void fill_record(const ray& r, int index, real t, hit_record& rec) const {
+            point3 center(cx[index], cy[index], cz[index]);
+            rec.t = t;
+            rec.p = refine_sphere_point(r.at(rec.t), center, radius[index], rec.error);
+            vec3 outward_normal = (rec.p - center) / radius[index];
+            rec.set_face_normal(r, outward_normal);
+            rec.mat = &materials[mat_index[index]];
+        }
+
+        // nearest root within ray_t among the first `count` spheres of the block at `first`.
+        // returns its lane and stores the distance in t_out, or returns -1 on a miss
+        int hit_block(const ray& r, int first, int count, interval ray_t, real& t_out) const {
+            RT_COUNT_N(primitive_tests, count);
+            const point3& o = r.origin();
+            const vec3& d = r.direction();
+            real a = d.length_squared();
+
+#ifdef RT_HAVE_SIMD
+            real_vec dx = vsplat(d.x()), dy = vsplat(d.y()), dz = vsplat(d.z());
+            real_vec va = vsplat(a);
+            real_vec ocx = vsub(vload(&cx[first]), vsplat(o.x()));
+            real_vec ocy = vsub(vload(&cy[first]), vsplat(o.y()));
+            real_vec ocz = vsub(vload(&cz[first]), vsplat(o.z()));
+            real_vec rad = vload(&radius[first]);
+
+            real_vec h = vadd(vadd(vmul(dx, ocx), vmul(dy, ocy)), vmul(dz, ocz));
+            real_vec len_sq = vadd(vadd(vmul(ocx, ocx), vmul(ocy, ocy)), vmul(ocz, ocz));
+            real_vec c = vsub(len_sq, vmul(rad, rad));
+            real_vec disc = vsub(vmul(h, h), vmul(va, c));
+
+            real_mask valid = mask_and(vge(disc, vsplat(0)), mask_first(count));
+            if (!mask_bits(valid)) return -1;
+
+            real_vec tmin = vsplat(ray_t.min), tmax = vsplat(ray_t.max);
+            real_vec sqrtd = vsqrt(disc);
+            real_vec near_root = vdiv(vsub(h, sqrtd), va);
+            real_vec far_root = vdiv(vadd(h, sqrtd), va);
+            real_mask near_ok = mask_and(valid, mask_and(vgt(near_root, tmin), vlt(near_root, tmax)));
+            real_mask far_ok = mask_andnot(near_ok, mask_and(valid, mask_and(vgt(far_root, tmin), vlt(far_root, tmax))));
+            unsigned mask = mask_bits(mask_or(near_ok, far_ok));
+            if (!mask) return -1;
+
+            alignas(64) real roots[sphere_lanes];
+            vstore(roots, vselect(near_ok, near_root, far_root));
+#else
+            // scalar fallback, same arithmetic one lane at a time
+            unsigned mask = 0;
+            real roots[sphere_lanes];
+            for (int k = 0; k < count; k++) {
+                real ocx = cx[first + k] - o.x(), ocy = cy[first + k] - o.y(), ocz = cz[first + k] - o.z();
+                real h = d.x()*ocx + d.y()*ocy + d.z()*ocz;
+                real c = (ocx*ocx + ocy*ocy + ocz*ocz) - radius[first + k] * radius[first + k];
+                real disc = h*h - a*c;
+                if (disc < 0) continue;
+
+                real sqrtd = std::sqrt(disc);
+                real root = (h - sqrtd) / a;
+                if (!ray_t.surrounds(root)) {
+                    root = (h + sqrtd) / a;
+                    if (!ray_t.surrounds(root)) continue;
+                }
+                roots[k] = root;
+                mask |= 1u << k;
+            }
+            if (!mask) return -1;
+#endif
+
+            int best = -1;
+            for (int k = 0; k < sphere_lanes; k++) {
+                if ((mask >> k & 1) && (best < 0 || roots[k] < roots[best]))
+                    best = k;
+            }
+            t_out = roots[best];
+            return best;
+        }
+};
+
+#endif
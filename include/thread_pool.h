@@ -0,0 +1,193 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// cpus this process may run on, ordered so that consecutive entries alternate between NUMA
+// nodes: worker k of a pinned pool takes entry k, and a pool smaller than the machine spreads
+// its threads, and the memory they first touch, over every node's controllers. without NUMA
+// information in sysfs this is just the allowed cpus in order
+inline std::vector<int> placement_cpus() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return {};
+
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0;; node++) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in) break;
+        // a list of ranges such as 0-15,32-47
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first = 0, last = 0;
+            char dash = 0;
+            std::istringstream fields(range);
+            if (!(fields >> first)) continue;
+            last = (fields >> dash >> last) ? last : first;
+            for (int cpu = first; cpu <= last; cpu++)
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed)) nodes.back().push_back(cpu);
+    }
+
+    std::vector<int> order;
+    for (size_t k = 0, added = 1; added; k++) {
+        added = 0;
+        for (const auto& cpus : nodes) {
+            if (k < cpus.size()) {
+                order.push_back(cpus[k]);
+                added++;
+            }
+        }
+    }
+    return order;
+}
+
+// splits [0, count) into `chunks` contiguous ranges and runs fn(chunk, begin, end) on each, one
+// thread per range with the last on the caller's. the first exception thrown by any chunk is
+// rethrown once all have finished
+template <typename chunk_fn>
+void parallel_chunks(size_t count, int chunks, chunk_fn&& fn) {
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(chunks);
+    for (int c = 0; c < chunks; c++) {
+        size_t begin = count * c / chunks, end = count * (c + 1) / chunks;
+        auto run = [&, c, begin, end]() {
+            try {
+                fn(c, begin, end);
+            } catch (...) {
+                errors[c] = std::current_exception();
+            }
+        };
+        if (c + 1 == chunks) run(); else threads.emplace_back(run);
+    }
+    for (auto& t : threads)
+        t.join();
+    for (auto& e : errors)
+        if (e) std::rethrow_exception(e);
+}
+
+// fixed set of threads kept alive from one job to the next, so a render call does not pay
+// for starting them. a job is a function called once on every thread with its index; run
+// returns when all calls have, rethrowing the first exception any of them threw. once a call
+// has thrown, cancelled() is true for the rest of the job so the others can stop early
+class thread_pool {
+    public:
+        // with pin, thread k is bound to entry k of placement_cpus()
+        thread_pool(unsigned int count, bool pin = false) : pin(pin) {
+            std::vector<int> cpus;
+            if (pin) cpus = placement_cpus();
+            for (unsigned int i = 0; i < count; i++) {
+                threads.emplace_back([this, i] { work(i); });
+                if (!cpus.empty()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus[i % cpus.size()], &set);
+                    pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set);
+                }
+            }
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                quitting = true;
+            }
+            job_ready.notify_all();
+            for (auto& t : threads)
+                t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        unsigned int size() const { return unsigned(threads.size()); }
+        bool pinned() const { return pin; }
+        bool cancelled() const { return cancel.load(std::memory_order_relaxed); }
+
+        // hands job to every thread and returns at once; wait collects the outcome
+        void start(std::function<void(unsigned int)> fn) {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                job = std::move(fn);
+                error = nullptr;
+                cancel = false;
+                running = size();
+                generation++;
+            }
+            job_ready.notify_all();
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(m);
+            job_done.wait(lock, [&] { return running == 0; });
+            job = nullptr;
+            if (error) {
+                std::exception_ptr e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+        void run(std::function<void(unsigned int)> fn) {
+            start(std::move(fn));
+            wait();
+        }
+
+    private:
+        std::vector<std::thread> threads;
+        bool pin;
+
+        std::mutex m;
+        std::condition_variable job_ready;
+        std::condition_variable job_done;
+        std::function<void(unsigned int)> job;
+        std::exception_ptr error;
+        std::atomic<bool> cancel{false};
+        unsigned int running = 0;
+        unsigned long long generation = 0;
+        bool quitting = false;
+
+        void work(unsigned int index) {
+            unsigned long long seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    job_ready.wait(lock, [&] { return quitting || generation != seen; });
+                    if (quitting) return;
+                    seen = generation;
+                }
+                try {
+                    job(index);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (!error) error = std::current_exception();
+                    cancel = true;
+                }
+                std::lock_guard<std::mutex> lock(m);
+                if (--running == 0)
+                    job_done.notify_all();
+            }
+        }
+};
+
+#endif
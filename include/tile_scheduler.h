@@ -0,0 +1,70 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// rectangle of pixels [x0, x1) x [y0, y1)
+struct tile {
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+};
+
+// when and for how long one tile was rendered, in seconds from the start of the render
+struct tile_timing {
+    tile t;
+    double start;
+    double seconds;
+};
+
+// work done by one render thread, used to report how evenly the tiles were spread
+struct thread_utilization {
+    int tiles = 0;
+    long long pixels = 0;
+    long long samples = 0; // camera rays, i.e. pixel samples actually taken
+    long long rays = 0;    // path segments traced, camera rays included
+    double busy_seconds = 0;
+    std::vector<tile_timing> timings; // one entry per tile, in the order rendered
+};
+
+// splits the image into square tiles handed out through a shared atomic cursor.
+// threads keep pulling tiles until the queue is empty, so a slow tile only delays the
+// thread that owns it and every core stays busy until the last few tiles
+class tile_scheduler {
+    public:
+        tile_scheduler(int image_width, int image_height, int tile_size) {
+            tile_size = std::max(1, tile_size);
+            for (int y = 0; y < image_height; y += tile_size) {
+                for (int x = 0; x < image_width; x += tile_size) {
+                    tiles.push_back(tile{x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)});
+                }
+            }
+        }
+
+        // claims the next unrendered tile, returns false once all tiles are taken
+        bool next(tile& t) {
+            int index = cursor.fetch_add(1, std::memory_order_relaxed);
+            if (index >= int(tiles.size()))
+                return false;
+            t = tiles[index];
+            return true;
+        }
+
+        // hands out no more tiles; the ones already claimed are still rendered
+        void cancel() {
+            cursor.store(int(tiles.size()), std::memory_order_relaxed);
+        }
+
+        int tile_count() const { return int(tiles.size()); }
+
+        const std::vector<tile>& all_tiles() const { return tiles; }
+
+    private:
+        std::vector<tile> tiles;
+        std::atomic<int> cursor{0};
+};
+
+#endif
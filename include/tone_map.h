@@ -0,0 +1,87 @@
+#ifndef TONE_MAP_H
+#define TONE_MAP_H
+
+#include "image_buffer.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+enum class tone_curve {
+    clamp, // radiance above 1 saturates
+    aces   // Narkowicz's fit of the ACES filmic curve, which rolls highlights off instead
+};
+
+// 8-bit level of x under the square-root gamma: the largest k <= 256 sqrt(x), at most 255.
+// the root is estimated from the exponent bits and refined by two newton steps, rounded with
+// the 1.5 * 2^23 bias as in exp_negative and corrected by comparing squares, which are exact in
+// float. std::sqrt may set errno, and floor or an int conversion would also stop the vectorizer
+inline float gamma2_level(float x) {
+    constexpr float round_bias = 12582912.0f;
+    float m = 65536 * std::min(std::max(0.0f, x), 1.0f); // a nan comes out black
+    int32_t bits;
+    std::memcpy(&bits, &m, sizeof(bits));
+    bits = 0x1fbd1df5 + (bits >> 1);
+    float y;
+    std::memcpy(&y, &bits, sizeof(y));
+    y = 0.5f * (y + m / y);
+    y = 0.5f * (y + m / y);
+    float k = (y + round_bias) - round_bias;
+    k += (k + 1) * (k + 1) <= m ? 1.0f : 0.0f;
+    k -= k * k > m ? 1.0f : 0.0f;
+    return std::min(k, 255.0f);
+}
+
+// turns accumulated linear radiance into 8-bit display values. the render loop only adds up
+// radiance; this runs once per row as an image is written, so one render can be written at
+// any exposure or curve, or as linear radiance, without tracing it again. the defaults give
+// the square-root gamma and 256-level quantization the renderer has always written
+struct tone_mapping {
+    float exposure = 0; // stops, each one doubling the radiance
+    tone_curve curve = tone_curve::clamp;
+    float gamma = 2;
+
+    // count pixels of sums to interleaved 8-bit rgb. the pixels are averaged into the thread's
+    // scratch memory first, so the curve and the quantization run over one contiguous array
+    // of floats and vectorize
+    void apply(const accum_pixel* pixels, int count, uint8_t* rgb) const {
+        arena& scratch = thread_scratch();
+        auto scratch_start = scratch.mark();
+        int n = 3 * count;
+        float* v = scratch.make_array<float>(n, cache_line_size);
+
+        float gain = std::exp2(exposure);
+        for (int i = 0; i < count; i++) {
+            const accum_pixel& p = pixels[i];
+            float weight = p.weight > 0 ? p.weight : 1; // an empty pixel's sums are zero
+            v[3 * i] = p.r / weight * gain;
+            v[3 * i + 1] = p.g / weight * gain;
+            v[3 * i + 2] = p.b / weight * gain;
+        }
+
+        if (curve == tone_curve::aces) {
+            for (int k = 0; k < n; k++) {
+                float x = std::max(0.0f, v[k]);
+                v[k] = std::min(x * (2.51f * x + 0.03f) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
+            }
+        }
+
+        if (gamma == 2) {
+            for (int k = 0; k < n; k++)
+                rgb[k] = uint8_t(int(gamma2_level(v[k])));
+        } else {
+            float inverse = 1 / gamma;
+            for (int k = 0; k < n; k++)
+                rgb[k] = uint8_t(int(256 * std::min(std::pow(std::max(0.0f, v[k]), inverse), 0.999f)));
+        }
+        scratch.rewind(scratch_start);
+    }
+
+    void apply(pixel_span<const accum_pixel> row, uint8_t* rgb) const {
+        apply(row.data, row.count, rgb);
+    }
+};
+
+#endif
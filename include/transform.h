@@ -0,0 +1,130 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "constants.h"
+#include "aabb.h"
+
+// affine map p -> A p + b, stored as a row-major 3x4 matrix [A | b]
+class transform {
+    public:
+        real m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+        static transform translate(const vec3& offset) {
+            transform t;
+            for (int i = 0; i < 3; i++) t.m[i][3] = offset[i];
+            return t;
+        }
+
+        static transform scale(const vec3& factors) {
+            transform t;
+            for (int i = 0; i < 3; i++) t.m[i][i] = factors[i];
+            return t;
+        }
+
+        static transform scale(double factor) { return scale(vec3(factor, factor, factor)); }
+
+        // counter-clockwise about axis when looking down it, axis need not be unit length
+        static transform rotate(const vec3& axis, double degrees) {
+            vec3 a = unit_vector(axis);
+            double c = std::cos(degrees_to_radians(degrees)), s = std::sin(degrees_to_radians(degrees));
+            double k = 1 - c;
+            transform t;
+            t.m[0][0] = c + a.x()*a.x()*k;         t.m[0][1] = a.x()*a.y()*k - a.z()*s;  t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+            t.m[1][0] = a.y()*a.x()*k + a.z()*s;   t.m[1][1] = c + a.y()*a.y()*k;        t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+            t.m[2][0] = a.z()*a.x()*k - a.y()*s;   t.m[2][1] = a.z()*a.y()*k + a.x()*s;  t.m[2][2] = c + a.z()*a.z()*k;
+            return t;
+        }
+
+        // this applied after other
+        transform operator*(const transform& other) const {
+            transform t;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    real sum = j == 3 ? m[i][3] : 0;
+                    for (int k = 0; k < 3; k++)
+                        sum += m[i][k] * other.m[k][j];
+                    t.m[i][j] = sum;
+                }
+            }
+            return t;
+        }
+
+        transform inverse() const {
+            // inverse of the linear part by cofactors, then the offset is carried through it
+            real det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                       - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                       + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+            real inv_det = 1 / det;
+
+            transform t;
+            t.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+            t.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+            t.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+            t.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+            t.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+            t.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+            t.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+            t.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+            t.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+            for (int i = 0; i < 3; i++)
+                t.m[i][3] = -(t.m[i][0]*m[0][3] + t.m[i][1]*m[1][3] + t.m[i][2]*m[2][3]);
+            return t;
+        }
+
+        point3 apply_point(const point3& p) const {
+            return point3(
+                m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+        }
+
+        // maps a point whose coordinates are each within p_error of the true point, and sets
+        // error to the same bound on the result
+        point3 apply_point(const point3& p, real p_error, real& error) const {
+            error = 0;
+            for (int i = 0; i < 3; i++) {
+                real terms = std::fabs(m[i][0]*p.x()) + std::fabs(m[i][1]*p.y()) + std::fabs(m[i][2]*p.z()) + std::fabs(m[i][3]);
+                real scale = std::fabs(m[i][0]) + std::fabs(m[i][1]) + std::fabs(m[i][2]);
+                error = std::fmax(error, rounding_gamma(3) * terms + (1 + rounding_gamma(3)) * scale * p_error);
+            }
+            return apply_point(p);
+        }
+
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(
+                m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+        }
+
+        // multiplies by the transposed linear part. on a world-to-object transform this carries
+        // an object-space normal to world space
+        vec3 apply_transposed(const vec3& v) const {
+            return vec3(
+                m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+        }
+
+        // smallest box around the transformed box, built axis by axis from the matrix entries
+        aabb apply(const aabb& box) const {
+            if (box.is_empty()) return box;
+            interval axes[3];
+            for (int i = 0; i < 3; i++) {
+                real lo = m[i][3], hi = m[i][3], magnitude = std::fabs(m[i][3]);
+                for (int k = 0; k < 3; k++) {
+                    const interval& src = box.axis_interval(k);
+                    real a = m[i][k] * src.min, b = m[i][k] * src.max;
+                    lo += std::fmin(a, b);
+                    hi += std::fmax(a, b);
+                    magnitude += std::fmax(std::fabs(a), std::fabs(b));
+                }
+                // widened by the rounding of the sums so the box still holds the transformed one
+                real pad = rounding_gamma(4) * magnitude;
+                axes[i] = interval(lo - pad, hi + pad);
+            }
+            return aabb(axes[0], axes[1], axes[2]);
+        }
+};
+
+#endif
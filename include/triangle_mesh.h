@@ -0,0 +1,273 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "bvh.h"
+#include "line_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// indexed triangle mesh with one material. vertices are shared between faces and stored as
+// floats, faces are three 32-bit vertex indices, and a bvh_tree over the faces lives inside the
+// mesh, so a triangle costs 12 bytes of indices plus its share of vertices and tree nodes
+// instead of a hittable object of its own. rays are tested with Möller–Trumbore and hit_record
+// is only filled for the closest face
+class triangle_mesh : public hittable {
+    public:
+        triangle_mesh(const material* mat) : mat(mat) {}
+
+        uint32_t add_vertex(const point3& p) {
+            vertices.push_back(vertex{float(p.x()), float(p.y()), float(p.z())});
+            return uint32_t(vertices.size() - 1);
+        }
+
+        void add_triangle(uint32_t a, uint32_t b, uint32_t c) {
+            faces.push_back(a);
+            faces.push_back(b);
+            faces.push_back(c);
+        }
+
+        size_t vertex_count() const { return vertices.size(); }
+        size_t triangle_count() const { return faces.size() / 3; }
+
+        // bytes held by the vertex, face and tree buffers
+        size_t memory_usage() const {
+            return vertices.capacity() * sizeof(vertex) + faces.capacity() * sizeof(uint32_t)
+                 + tree.nodes.capacity() * sizeof(bvh_tree::node) + area_cdf.capacity() * sizeof(double);
+        }
+
+        // reorders the faces into leaf order; must be called before the mesh is hit
+        void build() {
+            size_t count = triangle_count();
+            std::vector<aabb> boxes(count);
+            for (size_t f = 0; f < count; f++) {
+                point3 a = position(faces[3 * f]), b = position(faces[3 * f + 1]), c = position(faces[3 * f + 2]);
+                boxes[f] = aabb(aabb(a, b), aabb(c, c));
+            }
+
+            // a face test costs little next to a node visit, so leaves of up to eight faces are
+            // priced as if four faces took one test. this halves the node count (about 40 bytes
+            // per triangle in all) at no cost in render time
+            tree.build(boxes, 8, 4);
+
+            std::vector<uint32_t> ordered(faces.size());
+            for (size_t k = 0; k < count; k++)
+                for (int v = 0; v < 3; v++)
+                    ordered[3 * k + v] = faces[3 * size_t(tree.indices[k]) + v];
+            faces.swap(ordered);
+            faces.shrink_to_fit();
+            vertices.shrink_to_fit();
+            tree.nodes.shrink_to_fit();
+            tree.indices.clear();
+            tree.indices.shrink_to_fit();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            int closest = -1;
+            real closest_t = 0, closest_u = 0, closest_v = 0;
+            tree.traverse(r, ray_t, [&](int first, int count, interval& t) {
+                bool hit_anything = false;
+                for (int f = first; f < first + count; f++) {
+                    real face_t, u, v;
+                    if (intersect(r, f, t, face_t, u, v)) {
+                        closest = f;
+                        closest_t = face_t;
+                        closest_u = u;
+                        closest_v = v;
+                        t.max = face_t;
+                        hit_anything = true;
+                    }
+                }
+                return hit_anything;
+            });
+
+            if (closest < 0) return false;
+
+            point3 a = position(faces[3 * closest]), b = position(faces[3 * closest + 1]), c = position(faces[3 * closest + 2]);
+            rec.t = closest_t;
+
+            // the point is taken from the barycentric coordinates rather than from t, which
+            // keeps it within a few roundings of the face whatever the ray's length
+            real w = 1 - closest_u - closest_v;
+            vec3 pa = w * a, pb = closest_u * b, pc = closest_v * c;
+            rec.p = pa + pb + pc;
+            rec.error = rounding_gamma(7) * max_abs(vec3(
+                std::fabs(pa.x()) + std::fabs(pb.x()) + std::fabs(pc.x()),
+                std::fabs(pa.y()) + std::fabs(pb.y()) + std::fabs(pc.y()),
+                std::fabs(pa.z()) + std::fabs(pb.z()) + std::fabs(pc.z())));
+            rec.set_face_normal(r, unit_vector(cross(b - a, c - a)));
+            rec.mat = mat;
+            return true;
+        }
+
+        aabb bounding_box() const override { return tree.bounds(); }
+
+        // sums the face areas into the table random draws faces from, so the mesh can be used
+        // as a light. only emissive meshes pay for it, after build
+        void prepare_light_sampling() {
+            area_cdf.resize(triangle_count());
+            double total = 0;
+            for (size_t f = 0; f < triangle_count(); f++) {
+                point3 a = position(faces[3 * f]), b = position(faces[3 * f + 1]), c = position(faces[3 * f + 2]);
+                total += 0.5 * double(cross(b - a, c - a).length());
+                area_cdf[f] = total;
+            }
+            total_area = total;
+        }
+
+        // a point is drawn uniformly over the surface, by face area and then within the face;
+        // its density per unit area turns into one per solid angle by distance^2 / cosine
+        double pdf_value(const point3& origin, const vec3& direction) const override {
+            if (total_area <= 0) return 0.0;
+            hit_record rec;
+            if (!hit(ray(origin, direction), interval(0, infinity), rec))
+                return 0.0;
+            double length = direction.length();
+            double distance = rec.t * length;
+            double cosine = std::fabs(dot(direction, rec.normal)) / length;
+            if (cosine <= 0) return 0.0;
+            return distance * distance / (cosine * total_area);
+        }
+
+        vec3 random(const point3& origin, const sample2& u) const override {
+            if (total_area <= 0) return vec3(1,0,0);
+            // u.u picks the face, and its position within the face's share of the area is
+            // reused as the first coordinate on it
+            double pick = u.u * total_area;
+            size_t f = size_t(std::upper_bound(area_cdf.begin(), area_cdf.end(), pick) - area_cdf.begin());
+            f = std::min(f, area_cdf.size() - 1);
+            double below = f > 0 ? area_cdf[f - 1] : 0;
+            double within = area_cdf[f] > below ? std::clamp((pick - below) / (area_cdf[f] - below), 0.0, 1.0) : 0.5;
+            double s = std::sqrt(within), t = u.v;
+            point3 a = position(faces[3 * f]), b = position(faces[3 * f + 1]), c = position(faces[3 * f + 2]);
+            point3 p = real(1 - s) * a + real(s * (1 - t)) * b + real(s * t) * c;
+            return p - origin;
+        }
+
+    private:
+        struct vertex {
+            float x, y, z;
+        };
+
+        std::vector<vertex> vertices;
+        std::vector<uint32_t> faces; // three vertex indices per triangle, in leaf order after build
+        bvh_tree tree;
+        const material* mat;
+        std::vector<double> area_cdf; // running sums of face areas, empty unless the mesh is a light
+        double total_area = 0;
+
+        point3 position(uint32_t index) const {
+            const vertex& v = vertices[index];
+            return point3(v.x, v.y, v.z);
+        }
+
+        bool intersect(const ray& r, int face, const interval& ray_t, real& t, real& u, real& v) const {
+            RT_COUNT(primitive_tests);
+            point3 v0 = position(faces[3 * face]);
+            vec3 e1 = position(faces[3 * face + 1]) - v0;
+            vec3 e2 = position(faces[3 * face + 2]) - v0;
+
+            vec3 pvec = cross(r.direction(), e2);
+            real det = dot(e1, pvec);
+            if (det == 0) // ray parallel to the face, or a degenerate face
+                return false;
+            real inv_det = 1 / det;
+
+            vec3 tvec = r.origin() - v0;
+            u = dot(tvec, pvec) * inv_det;
+            if (u < 0 || u > 1) return false;
+
+            vec3 qvec = cross(tvec, e1);
+            v = dot(r.direction(), qvec) * inv_det;
+            if (v < 0 || u + v > 1) return false;
+
+            t = dot(e2, qvec) * inv_det;
+            return ray_t.surrounds(t);
+        }
+};
+
+// reads the vertices and faces of a Wavefront OBJ file into a built mesh. the file is read in
+// fixed-size blocks and parsed a line at a time, so memory holds only the mesh itself.
+// polygons are split into triangle fans; texture coordinates, normals, groups and materials
+// are ignored
+inline shared_ptr<triangle_mesh> load_obj(const std::string& path, const material* mat) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot open mesh file: " + path);
+
+    auto mesh = make_shared<triangle_mesh>(mat);
+    size_t line_number = 0;
+    auto fail = [&](const std::string& what) {
+        return std::runtime_error(path + ":" + std::to_string(line_number) + ": " + what);
+    };
+
+    std::vector<uint32_t> corners;
+    auto parse_line = [&](const char* line, const char* line_end) {
+        line_number++;
+        line_reader fields(line, line_end);
+        std::string_view key;
+        if (!fields.word(key) || key[0] == '#')
+            return;
+
+        if (key == "v") {
+            double x, y, z;
+            if (!(fields.number(x) && fields.number(y) && fields.number(z)))
+                throw fail("malformed vertex");
+            mesh->add_vertex(point3(x, y, z));
+        } else if (key == "f") {
+            // indices are 1-based, negative ones count back from the latest vertex
+            corners.clear();
+            long long index;
+            while (!fields.at_end()) {
+                if (!fields.integer(index))
+                    throw fail("malformed face");
+                fields.skip_word();
+                long long resolved = index < 0 ? (long long)mesh->vertex_count() + index : index - 1;
+                if (resolved < 0 || resolved >= (long long)mesh->vertex_count())
+                    throw fail("face refers to vertex " + std::to_string(index) + " which does not exist");
+                corners.push_back(uint32_t(resolved));
+            }
+            if (corners.size() < 3)
+                throw fail("face with fewer than three vertices");
+            for (size_t k = 1; k + 1 < corners.size(); k++)
+                mesh->add_triangle(corners[0], corners[k], corners[k + 1]);
+        }
+    };
+
+    constexpr size_t block_size = 1 << 20;
+    std::vector<char> buffer(block_size);
+    size_t carried = 0; // bytes of an unfinished line kept from the previous block
+    while (in) {
+        if (carried == buffer.size())
+            buffer.resize(buffer.size() * 2); // a single line longer than the buffer
+        in.read(buffer.data() + carried, std::streamsize(buffer.size() - carried));
+        size_t filled = carried + size_t(in.gcount());
+        bool last_block = !in;
+
+        const char* p = buffer.data();
+        const char* end = buffer.data() + filled;
+        while (p < end) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+            if (!nl && !last_block) break;
+            const char* line_end = nl ? nl : end;
+            parse_line(p, line_end);
+            p = line_end + 1;
+        }
+
+        carried = p < end ? size_t(end - p) : 0;
+        std::memmove(buffer.data(), p < end ? p : end, carried);
+    }
+
+    if (mesh->triangle_count() == 0)
+        throw std::runtime_error(path + ": no faces");
+    mesh->build();
+    return mesh;
+}
+
+#endif
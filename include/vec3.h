@@ -3,107 +3,135 @@
 
 #include "constants.h"
 
-class vec3 {
+// three-component vector over scalar T. the pipeline uses vec3 = vec3_t<real>, see constants.h
+template <typename T>
+class vec3_t {
     public: 
-        double e[3];
+        using scalar = T;
 
-        vec3() : e{0,0,0} {}
+        T e[3];
 
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        vec3_t() : e{0,0,0} {}
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const {return e[2]; }
+        vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        // between precisions, e.g. scene data kept in double while tracing in float
+        template <typename U>
+        explicit vec3_t(const vec3_t<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-        vec3& operator+=( const vec3& v){
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const {return e[2]; }
+
+        vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+        T operator[](int i) const { return e[i]; }
+        T& operator[](int i) { return e[i]; }
+
+        vec3_t& operator+=( const vec3_t& v){
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
             return *this;
         }
 
-        vec3& operator*=( double t){
+        vec3_t& operator*=( T t){
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
             return *this;
         }
 
-        vec3& operator /=(double t) {
+        vec3_t& operator /=(T t) {
             return *this *= 1/t;
         }
 
-        double length() const {
+        T length() const {
             return std::sqrt(length_squared());
         }
 
-        double length_squared() const {
+        T length_squared() const {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
 
         bool near_zero() const {
-            auto s = 1e-8;
+            T s = T(1e-8);
             return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
         }
 
-        static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        static vec3_t random() {
+            return vec3_t(T(random_double()), T(random_double()), T(random_double()));
         }
 
-        static vec3 random(double min, double max) {
-            return vec3(random_double(min, max), random_double(min, max), random_double(min,max));
+        static vec3_t random(double min, double max) {
+            return vec3_t(T(random_double(min, max)), T(random_double(min, max)), T(random_double(min,max)));
         }
 
 };
 
+using vec3 = vec3_t<real>;
 using point3 = vec3;
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3&v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+// scalars are taken as vec3_t<T>::scalar, which is not deduced, so a double literal or
+// variable converts to the vector's precision instead of failing to match
+
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>&v) {
+    return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3& u, const vec3&v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>&v) {
+    return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
  
-inline vec3 operator*(const vec3& u, const vec3& v) {
-    return vec3(v.e[0] * u.e[0], v.e[1] * u.e[1], v.e[2] * u.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v) {
+    return vec3_t<T>(v.e[0] * u.e[0], v.e[1] * u.e[1], v.e[2] * u.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v) {
-    return vec3(v.e[0] * t, v.e[1] * t, v.e[2] * t);
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T>& v) {
+    return vec3_t<T>(v.e[0] * t, v.e[1] * t, v.e[2] * t);
 }
 
-inline vec3 operator*(const vec3& v, double t) {
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, typename vec3_t<T>::scalar t) {
     return t * v;
 }
 
-inline vec3 operator/(const vec3& v, double t) {
+template <typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, typename vec3_t<T>::scalar t) {
     return (1/t) * v;
 }
 
-inline double dot(const vec3& u, const vec3& v) {
+template <typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v) {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1], 
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v) {
+    return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1], 
                 u.e[2] * v.e[0] - u.e[0] * v.e[2],
                 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(const vec3& v) {
+template <typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v) {
     return v / v.length();
 }
 
+// largest coordinate magnitude, the scale the rounding error of a point is measured against
+template <typename T>
+inline T max_abs(const vec3_t<T>& v) {
+    return std::fmax(std::fabs(v.e[0]), std::fmax(std::fabs(v.e[1]), std::fabs(v.e[2])));
+}
+
 inline vec3 random_in_unit_disk() {
     while (true) {
         auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
@@ -117,8 +145,8 @@ inline vec3 random_unit_vector() {
     while (true) {
         auto p = vec3::random(-1,1);
         auto lensq = p.length_squared();
-        if (1e-160 < lensq && lensq <= 1)
-            return p / sqrt(lensq);
+        if (std::numeric_limits<real>::min() < lensq && lensq <= 1)
+            return p / std::sqrt(lensq);
     }
 }
 
@@ -135,10 +163,10 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = std::fmin(dot(-uv, n), 1.0);
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+    real cos_theta = std::fmin(dot(-uv, n), real(1));
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -std::sqrt(std::fabs(1.0 - r_out_perp.length_squared())) * n; 
+    vec3 r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n; 
     return r_out_perp + r_out_parallel;
 }
 
@@ -2,68 +2,186 @@
 #include "hittable.h"
 #include "hittable_list.h"
 #include "sphere.h"
+#include "sphere_set.h"
 #include "material.h"
 #include "camera.h"
+#include "scenes.h"
+#include "scene_file.h"
 
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <string>
 
-int main() {
-    // world
-    hittable_list world;
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+int main(int argc, char* argv[]) {
+    std::string output_path, scene_path, write_scene_path, checkpoint_path, preview_path;
+    std::string worker_of, animation_path, trace_path, sampler_name, curve_name;
+    bool progressive = false, denoise = false;
+    int local_workers = 0, listen_port = 0, interactive_port = -1, samples_override = 0;
+    tone_mapping tone;
 
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+    // usage: main [output] [--scene file] [--write-scene file.rtscene] [--progressive]
+    //             [--checkpoint file] [--preview file]
+    //             [--workers n] [--listen port] [--worker host:port] [--animation keys.txt]
+    //             [--trace trace.json] [--sampler independent|stratified|sobol|blue_noise]
+    //             [--interactive port] [--samples n] [--denoise]
+    //             [--exposure stops] [--tone-curve clamp|aces] [--gamma g]
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--exposure" && i + 1 < argc) {
+            tone.exposure = float(std::atof(argv[++i]));
+        } else if (arg == "--tone-curve" && i + 1 < argc) {
+            curve_name = argv[++i];
+        } else if (arg == "--gamma" && i + 1 < argc) {
+            tone.gamma = float(std::atof(argv[++i]));
+        } else if (arg == "--samples" && i + 1 < argc) {
+            samples_override = std::atoi(argv[++i]);
+        } else if (arg == "--interactive" && i + 1 < argc) {
+            interactive_port = std::atoi(argv[++i]);
+        } else if (arg == "--sampler" && i + 1 < argc) {
+            sampler_name = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--animation" && i + 1 < argc) {
+            animation_path = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            local_workers = std::atoi(argv[++i]);
+        } else if (arg == "--listen" && i + 1 < argc) {
+            listen_port = std::atoi(argv[++i]);
+        } else if (arg == "--worker" && i + 1 < argc) {
+            worker_of = argv[++i];
+        } else if (arg == "--progressive") {
+            progressive = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            progressive = true;
+            checkpoint_path = argv[++i];
+        } else if (arg == "--preview" && i + 1 < argc) {
+            preview_path = argv[++i];
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (arg == "--write-scene" && i + 1 < argc) {
+            write_scene_path = argv[++i];
+        } else {
+            output_path = arg;
+        }
+    }
 
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
+    if (!write_scene_path.empty() && scene_path.empty()) {
+        std::cerr << "--write-scene needs a text scene given with --scene\n";
+        return 1;
+    }
+#ifndef RT_INSTRUMENT
+    if (!trace_path.empty()) {
+        std::cerr << "--trace needs a build with -DRT_INSTRUMENT=ON\n";
+        return 1;
+    }
+#endif
+    if (!worker_of.empty() && worker_of.rfind(':') == std::string::npos) {
+        std::cerr << "--worker needs the coordinator as host:port\n";
+        return 1;
+    }
 
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
+    sampler_type sampling = sampler_type::sobol;
+    if (sampler_name == "independent") sampling = sampler_type::independent;
+    else if (sampler_name == "stratified") sampling = sampler_type::stratified;
+    else if (sampler_name == "blue_noise") sampling = sampler_type::blue_noise;
+    else if (!sampler_name.empty() && sampler_name != "sobol") {
+        std::cerr << "unknown sampler '" << sampler_name << "', expected independent, stratified, sobol or blue_noise\n";
+        return 1;
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    if (curve_name == "aces") tone.curve = tone_curve::aces;
+    else if (!curve_name.empty() && curve_name != "clamp") {
+        std::cerr << "unknown tone curve '" << curve_name << "', expected clamp or aces\n";
+        return 1;
+    }
+    if (!(tone.gamma > 0)) {
+        std::cerr << "--gamma needs a positive value\n";
+        return 1;
+    }
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    int samples_per_pixel = 50, max_depth = 50;
+    scene s;
+    try {
+        // converts a text scene to the binary form, which loads without parsing
+        if (!write_scene_path.empty()) {
+            write_scene_binary(write_scene_path, read_scene_text(scene_path));
+            std::cout << "Scene written to " << write_scene_path << '\n';
+            return 0;
+        }
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+        if (scene_path.empty()) {
+            s = random_spheres_scene();
+        } else {
+            auto load_start = std::chrono::steady_clock::now();
+            s = load_scene(scene_path);
+            std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+            std::cout << "Loaded " << s.primitives << " primitives from " << scene_path << " in " << load_time.count() << "s\n";
+            samples_per_pixel = s.cam.samples_per_pixel;
+            max_depth = s.cam.max_depth;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
 
-    camera cam;
+    if (samples_override > 0)
+        samples_per_pixel = samples_override;
 
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 500;
-    cam.max_depth         = 50;
+    camera& cam = s.cam;
+    cam.adaptive_sampling      = true;
+    cam.russian_roulette_depth = 5;
+    cam.sampling               = sampling;
+    cam.progressive            = progressive;
+    cam.checkpoint_path        = checkpoint_path;
+    cam.preview_path           = preview_path;
+    cam.local_workers          = local_workers;
+    cam.listen_port            = listen_port;
+    cam.denoise                = denoise;
+    cam.tone                   = tone;
+    if (!output_path.empty())
+        cam.output_path = output_path;
 
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
+    // ctrl-c stops after the tiles in flight; progressive renders still write their image and checkpoint
+    std::signal(SIGINT, [](int) { render_interrupted = true; });
+    std::signal(SIGTERM, [](int) { render_interrupted = true; });
 
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
+    try {
+        // a worker renders tiles for a coordinator started with --listen on another machine,
+        // from the same scene and settings
+        if (!worker_of.empty()) {
+            size_t colon = worker_of.rfind(':');
+            cam.render_worker(s.world, samples_per_pixel, max_depth, worker_of.substr(0, colon), std::atoi(worker_of.c_str() + colon + 1));
+            return 0;
+        }
+        // a viewer on this machine (rt_preview) steers the camera and is sent progressive frames
+        if (interactive_port >= 0) {
+            cam.render_preview(s.world, samples_per_pixel, max_depth, interactive_port);
+            return 0;
+        }
+        // a fly-through renders one numbered image per frame from the same world
+        if (!animation_path.empty()) {
+            camera_keyframe start{0, cam.lookfrom, cam.lookat, cam.vfov, cam.focus_dist};
+            cam.render_animation(s.world, samples_per_pixel, max_depth, read_keyframes(animation_path, start));
+        } else {
+            cam.render(s.world, samples_per_pixel, max_depth);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
 
-    cam.render(world, 50, 50);
+#ifdef RT_INSTRUMENT
+    print_instrument_report(std::cout);
+    if (!trace_path.empty()) {
+        if (!write_chrome_trace(trace_path)) {
+            std::cerr << "Could not write " << trace_path << '\n';
+            return 1;
+        }
+        std::cout << "Trace written to " << trace_path << '\n';
+    }
+#endif
 }
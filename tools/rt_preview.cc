@@ -0,0 +1,153 @@
+#include "constants.h"
+#include "preview.h"
+#include "image_output.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// viewer for a renderer started with --interactive port. camera changes are read from stdin,
+// one scene-file style directive per line:
+//   lookfrom x y z | lookat x y z | vfov degrees | defocus_angle degrees | focus_dist d | quit
+// each line sends the whole view, and every completed pass of it is written to the output image
+// (renamed into place, so an image viewer that reloads on change shows the refinement)
+//
+// usage: rt_preview [--port n] [--out preview.png]
+
+int main(int argc, char* argv[]) {
+    int port = 7878;
+    std::string out_path = "preview.png";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--port" && has_value) port = std::atoi(argv[++i]);
+        else if (arg == "--out" && has_value) out_path = argv[++i];
+        else {
+            std::cerr << "unknown argument: " << arg << '\n';
+            return 1;
+        }
+    }
+
+    int fd;
+    preview_hello hello;
+    try {
+        make_image_writer(out_path);
+        fd = connect_to("127.0.0.1", port, 10);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (!recv_all(fd, &hello, sizeof(hello)) || std::memcmp(hello.magic, preview_magic, sizeof(hello.magic)) != 0) {
+        std::cerr << "port " << port << " does not serve a preview\n";
+        return 1;
+    }
+    if (hello.width == 0 || hello.height == 0 || hello.width > 1u << 15 || hello.height > 1u << 15) {
+        std::cerr << "renderer sent an image size of " << hello.width << "x" << hello.height << '\n';
+        return 1;
+    }
+    std::cout << "Previewing " << hello.width << "x" << hello.height << " into " << out_path << '\n';
+
+    // views are numbered like the renderer counts them, 0 being the one it started from
+    std::mutex m;
+    uint32_t latest_view = 0;
+    std::vector<std::chrono::steady_clock::time_point> sent_at{std::chrono::steady_clock::now()};
+    std::atomic<bool> connected{true};
+
+    // a tile's compressed pixels, at most: stored deflate blocks add a few bytes per 64 KiB, and
+    // no tile is larger than the image
+    const size_t max_tile_bytes = 3 * size_t(hello.width) * hello.height + (1 << 16);
+
+    std::thread receiver([&] {
+        image_buffer image(int(hello.height), int(hello.width));
+        zlib_decompressor stream;
+        std::vector<uint8_t> compressed, pixels;
+        preview_tile_header header;
+        try {
+            while (recv_all(fd, &header, sizeof(header))) {
+                // nothing is sized or stored from a header before it is checked; x0 < 0 marks
+                // the end of a pass, any other tile must lie within the image
+                tile t{header.x0, header.y0, header.x1, header.y1};
+                if (t.x0 >= 0 && (t.x0 >= t.x1 || t.y0 < 0 || t.y0 >= t.y1
+                                  || t.x1 > int(hello.width) || t.y1 > int(hello.height)))
+                    throw std::runtime_error("tile outside the image");
+                if (header.size > max_tile_bytes)
+                    throw std::runtime_error("tile of the wrong size");
+                compressed.resize(header.size);
+                if (!recv_all(fd, compressed.data(), compressed.size()))
+                    break;
+
+                // every tile is decoded, stale or not, to keep up with the stream
+                pixels.clear();
+                if (header.size > 0)
+                    stream.write(compressed.data(), compressed.size(), pixels);
+
+                std::chrono::steady_clock::time_point view_sent;
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (header.view != latest_view) continue;
+                    view_sent = sent_at[header.view];
+                }
+                int block = std::max(1, int(header.block));
+                if (t.x0 >= 0) {
+                    size_t expected = 3 * size_t(preview_block_count(t.width(), block)) * preview_block_count(t.height(), block);
+                    if (pixels.size() != expected)
+                        throw std::runtime_error("tile of the wrong size");
+                    store_preview_pixels(image, t, block, pixels.data());
+                    continue;
+                }
+
+                write_image(out_path, image);
+                std::chrono::duration<double, std::milli> since = std::chrono::steady_clock::now() - view_sent;
+                std::cout << "View " << header.view << ": ";
+                if (header.samples == 0)
+                    std::cout << "coarse frame";
+                else
+                    std::cout << header.samples << " samples per pixel";
+                std::cout << " after " << since.count() << " ms" << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+        }
+        connected = false;
+        std::cout << "Renderer closed the connection" << std::endl;
+    });
+
+    preview_view view = hello.view;
+    std::string line;
+    while (connected && std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        std::string key;
+        if (!(in >> key) || key[0] == '#') continue;
+        if (key == "quit") break;
+
+        bool ok;
+        if (key == "lookfrom")           ok = bool(in >> view.lookfrom[0] >> view.lookfrom[1] >> view.lookfrom[2]);
+        else if (key == "lookat")        ok = bool(in >> view.lookat[0] >> view.lookat[1] >> view.lookat[2]);
+        else if (key == "vfov")          ok = bool(in >> view.vfov);
+        else if (key == "defocus_angle") ok = bool(in >> view.defocus_angle);
+        else if (key == "focus_dist")    ok = bool(in >> view.focus_dist);
+        else ok = false;
+        if (!ok) {
+            std::cerr << "expected lookfrom x y z, lookat x y z, vfov, defocus_angle, focus_dist or quit\n";
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m);
+            latest_view++;
+            sent_at.push_back(std::chrono::steady_clock::now());
+        }
+        if (!send_all(fd, &view, sizeof(view)))
+            break;
+    }
+
+    ::shutdown(fd, SHUT_RDWR);
+    receiver.join();
+    ::close(fd);
+}